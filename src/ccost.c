@@ -2,8 +2,13 @@
 
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#if defined(RFM69_IRQ)
+#include <avr/sleep.h>
+#endif
 
 #include "port.h"
 #include "timer.h"
@@ -12,20 +17,302 @@
 #include "rfm69.h"
 
 #define CC_PAYLOAD_SIZE_MANCH 16
+#define CC_PAYLOAD_SIZE       (CC_PAYLOAD_SIZE_MANCH/2)
+#define CC_EARLY_CHECK_SIZE   2  // manchester bytes checked before reading the rest
+#define CC_STREAM_LEN         CC_PAYLOAD_SIZE_MANCH // bytes read by receive_stream()
 #define CC_TYPE_METER         0x00
 #define CC_TYPE_COUNTER       0x04
 #define CC_TYPE_PAIR          0x08
+#define CC_ID(buf)            ((((uint16_t)(buf)[0] & 0x0F)<<8) | (buf)[1]) // decoded
 
 #define DEBUG 1
 
+// Radio config, pick one:
+//   RFM69_CONFIG_CC_FSK       raw manchester, validated and decoded here
+//   RFM69_CONFIG_CC_FSK_MANCH radio decodes manchester, half the SPI traffic
+//                             but symbol errors can no longer be seen
+#define CC_CONFIG RFM69_CONFIG_CC_FSK
+
+// Every CC_STATS_EVERY frames an MSTAT:frames,rejects line is sent.
+// With CC_FSK, rejects are frames that failed manchester validation.
+// With CC_FSK_MANCH the radio never rejects a frame, so rejects are decoded
+// frames that fail the sanity check in payload_is_plausible(), which is
+// what bad manchester usually turns into. Run each config for a while
+// on site and compare.
+// With RFM69_FEI good frames also feed the carrier tracking, and MSTAT
+// gets a third column, how far the carrier has been retuned, in Hz.
+// With RFM69_NOISE the radio's RSSI threshold follows the noise floor,
+// and the floor and threshold (dBm) are added to MSTAT, so the effect
+// on rejects (syncs on noise) can be seen.
+#define CC_STATS_EVERY 64
+
+// Watchdog and radio health checks, see supervise()
+#define CC_SUPERVISOR 1
+
+// Listen on more than one radio config in turn, see scan_tick().
+// OpenThings frames are not decoded, just shown in hex as OT:len,bytes
+//#define CC_SCAN 1
+#define CC_SCAN_CYCLE 12 // seconds for one pass through all of them
+#define CC_SCAN_MIN   1  // seconds every config gets, heard on or not
+
+// Learn when each IAM will next send a METER frame, and report each one
+// that was due but not heard as LOST:id,missed,heard. With CC_SCAN the
+// other configs only get the time when no IAM is due. See predict_check().
+//#define CC_PREDICT 1
+#define CC_PREDICT_DEVICES 6                      // IAMs tracked at once
+#define CC_PREDICT_NOMINAL (6000/TIMER_TICK_MS)   // IAMs send about every 6s
+#define CC_PREDICT_WINDOW  (300/TIMER_TICK_MS)    // listen this long either side
+#define CC_PREDICT_FORGET  10                     // misses in a row, then dropped
+
+// Remember each IAM heard: its last watt readings, when it was last heard,
+// how many frames it has sent, how many of them could not be decoded
+// (with the ID still readable), and its RSSI. After each MSTAT line there
+// is a DEV:id,frames,errors,seconds_ago,rssi line for each one. When the
+// table is full, the IAM heard from longest ago makes way. See device_heard().
+//#define CC_DEVICES 8 // a power of 2, 15 bytes each, +8 with CC_DEADBAND, +10 with CC_WINDOW
+
+// Report by exception, needs CC_DEVICES. A METER frame is only shown when
+// one of its readings has moved from the last one shown for that IAM by
+// more than CC_DEADBAND_W watts or more than CC_DEADBAND_PCT percent,
+// either is enough (set one to 0 to only use the other), has become valid
+// or invalid, or when nothing has been shown for that IAM for CC_HEARTBEAT
+// seconds.
+// PAIR and other frames are always shown. See device_changed().
+//#define CC_DEADBAND 1
+#define CC_DEADBAND_W   10  // watts
+#define CC_DEADBAND_PCT 5   // percent
+#define CC_HEARTBEAT    300 // seconds, at most 600 as timer_ticks() wraps
+
+// Per IAM statistics, needs CC_DEVICES. The first watt reading of METER
+// and PAIR frames is summed over each CC_WINDOW seconds, and at the end of
+// each window there is a WIN:id,readings,min,mean,max line for every IAM
+// heard in it, with the mean to 0.1W. Adds 10 bytes to each CC_DEVICES
+// entry. See window_check().
+//#define CC_WINDOW 60 // seconds, at most 600 as timer_ticks() wraps
+
+// Send synthetic frames instead of receiving, to load test a receiver.
+// Frames go round robin over CC_TX_IDS, every CC_TX_PAIR_EVERY'th one is a
+// PAIR, and each gap in CC_TX_GAPS (in timer ticks) is held for
+// CC_TX_FRAMES frames before moving to the next, then it starts over.
+// Watt1 is a sequence number and Watt2 the gap in ms, so the receiver's
+// CSV alone shows which frames were lost at which rate. A frame is 43ms
+// on air, so the last gap (50ms) is close to back to back. See tx_tick().
+//#define CC_TX 1
+#define CC_TX_IDS        0xF01, 0xF02, 0xF03
+#define CC_TX_GAPS       100, 50, 20, 10, 5  // 1s down to 50ms
+#define CC_TX_FRAMES     200
+#define CC_TX_PAIR_EVERY 16
+
+// With two radios (RFM69_RADIOS=2 in build/makefile) both listen on the
+// same config, each on its own aerial. A frame heard by both is only shown
+// once, from the radio that heard it louder. See receive_diversity().
+#define CC_DIVERSITY_WAIT_MS 5 // for the other radio to finish the same frame
+
+#if (RFM69_RADIOS > 1) && !defined(RFM69_RSSI)
+#error "RFM69_RADIOS needs RFM69_RSSI, to pick the better copy of a frame"
+#endif
+#if (RFM69_RADIOS > 1) && (defined(RFM69_STREAM) || defined(CC_TX))
+#error "RFM69_RADIOS cannot be used with RFM69_STREAM or CC_TX"
+#endif
+#if defined(CC_TX) && (defined(CC_SCAN) || defined(CC_PREDICT) || defined(RFM69_LISTEN))
+#error "CC_TX only transmits, it cannot be used with CC_SCAN, CC_PREDICT or RFM69_LISTEN"
+#endif
+#if defined(CC_SCAN) && !defined(CC_SUPERVISOR)
+#error "CC_SCAN is timed by the supervisor's 1s watchdog tick"
+#endif
+#if defined(CC_PREDICT) && defined(RFM69_LISTEN)
+#error "CC_PREDICT is timed by Timer0, which stops while RFM69_LISTEN powers down"
+#endif
+#if defined(CC_DEVICES) && defined(RFM69_LISTEN)
+#error "CC_DEVICES is timed by Timer0, which stops while RFM69_LISTEN powers down"
+#endif
+#if defined(CC_DEVICES) && ((CC_DEVICES & (CC_DEVICES-1)) != 0)
+#error "CC_DEVICES must be a power of 2"
+#endif
+#if defined(CC_DEADBAND) && !defined(CC_DEVICES)
+#error "CC_DEADBAND keeps what was last shown in the CC_DEVICES table"
+#endif
+#if defined(CC_DEADBAND) && (CC_DEADBAND_W == 0) && (CC_DEADBAND_PCT == 0)
+#error "CC_DEADBAND needs CC_DEADBAND_W or CC_DEADBAND_PCT"
+#endif
+#if defined(CC_DEADBAND) && (CC_HEARTBEAT > 600)
+#error "CC_HEARTBEAT must be at most 600s, timer_ticks() wraps at 655s"
+#endif
+#if defined(CC_WINDOW) && !defined(CC_DEVICES)
+#error "CC_WINDOW keeps its sums in the CC_DEVICES table"
+#endif
+#if defined(CC_WINDOW) && (CC_WINDOW > 600)
+#error "CC_WINDOW must be at most 600s, timer_ticks() wraps at 655s"
+#endif
+#if defined(CC_SCAN) && defined(RFM69_STREAM)
+#error "RFM69_STREAM only understands CC frames, it cannot be used with CC_SCAN"
+#endif
+
+// Only report these IAM IDs (12 bit, as shown in the CSV), leave undefined
+// to report them all. With CC_FSK_MANCH, if they all have the same top
+// nybble, the radio drops frames for other nybbles itself (see
+// setup_id_filter), the rest of the check is done in cc_show().
+// The radio only has room for METER and PAIR, so it drops COUNTER frames
+// too, even from these IDs. Define CC_IDS_COUNTER to keep them, the check
+// is then all done in cc_show().
+//#define CC_IDS 0x123, 0x456
+//#define CC_IDS_COUNTER 1
+
+#if defined(CC_IDS) && (CC_CONFIG == RFM69_CONFIG_CC_FSK_MANCH) && !defined(CC_IDS_COUNTER)
+#define CC_ID_FILTER 1
+#endif
+
+#if defined(RFM69_STREAM) && (CC_CONFIG != RFM69_CONFIG_CC_FSK)
+#error "RFM69_STREAM decodes manchester itself, use RFM69_CONFIG_CC_FSK"
+#endif
+
+// Try to recover frames with a few unreadable manchester pairs (00 or 11,
+// usually one flipped bit) rather than rejecting them. Each unreadable
+// bit is tried both ways, and the frame is only kept if exactly one way
+// gives a frame from a recently seen ID, of a known type, with sane watt
+// valid bits. Recovered frames are shown as FIX: instead of DATA:, and
+// counted in an extra MSTAT column. See cc_repair().
+//#define CC_REPAIR 1
+#define CC_REPAIR_BITS 2  // unreadable bits tried, 2^bits candidates
+#define CC_REPAIR_IDS  8  // recently seen IDs remembered
+#define CC_REPAIRED    CC_PAYLOAD_SIZE // flag byte after the decoded frame, in the raw buffer
+
+#if defined(CC_REPAIR) && (defined(RFM69_STREAM) || (CC_CONFIG != RFM69_CONFIG_CC_FSK))
+#error "CC_REPAIR needs the raw manchester, use RFM69_CONFIG_CC_FSK without RFM69_STREAM"
+#endif
+
+// Queue received frames, so that the radio is not kept waiting while a
+// frame is printed. A line takes 30-40ms at 9600 baud, and the radio only
+// holds one frame, so without this a DEBUG frame (3 lines) can lose the
+// next frame of a burst. The radio is drained into a ring of CC_QUEUE raw
+// frames after every line printed, and the frames are checked, decoded
+// and printed from the ring. Frames lost to a full ring are counted in an
+// extra MSTAT column. See queue_drain().
+//#define CC_QUEUE 4 // slots, each 16 bytes plus RSSI and time
+
+#if defined(CC_QUEUE) && (defined(RFM69_STREAM) || defined(CC_SCAN) || defined(CC_TX) || (RFM69_RADIOS > 1))
+#error "CC_QUEUE cannot be used with RFM69_STREAM, CC_SCAN, CC_TX or RFM69_RADIOS"
+#endif
+#if defined(CC_QUEUE) && defined(RFM69_FEI)
+#error "CC_QUEUE cannot be used with RFM69_FEI, the FEI read would be for a later frame"
+#endif
+
+#if defined(DEBUG)
 static const char STR_RAW[]           PROGMEM = "RAW:";
 static const char STR_ERR_BAD_MANCH[] PROGMEM = "BADM:";
 static const char STR_OK_BUF[]        PROGMEM = "OK:";
+#endif
 static const char STR_DATA[]          PROGMEM = "DATA:";
 static const char STR_METER[]         PROGMEM = "meter";
 static const char STR_PAIR[]          PROGMEM = "pair";
 static const char STR_COUNTER[]       PROGMEM = "counter";
 static const char STR_UNKNOWN[]       PROGMEM = "unknown";
+static const char STR_MSTAT[]         PROGMEM = "MSTAT:";
+#if defined(CC_SCAN)
+static const char STR_OT[]            PROGMEM = "OT:";
+#endif
+#if defined(CC_PREDICT)
+static const char STR_LOST[]          PROGMEM = "LOST:";
+#endif
+#if defined(CC_DEVICES)
+static const char STR_DEV[]           PROGMEM = "DEV:";
+#endif
+#if defined(CC_WINDOW)
+static const char STR_WIN[]           PROGMEM = "WIN:";
+#endif
+#if defined(CC_REPAIR)
+static const char STR_FIX[]           PROGMEM = "FIX:";
+#endif
+#if defined(CC_TX)
+static const char STR_TX[]            PROGMEM = "TX:";
+#endif
+static const char STR_RADIO[]         PROGMEM = "RADIO:";
+#if defined(CC_SUPERVISOR)
+static const char STR_WDT_RESET[]     PROGMEM = "WDT:reset";
+#endif
+
+static uint8_t stat_frames  = 0;
+static uint8_t stat_rejects = 0;
+#if defined(CC_REPAIR)
+static uint8_t stat_repairs = 0;
+static uint16_t cc_recent[CC_REPAIR_IDS];     // IDs of good frames, a ring
+static uint8_t cc_recent_next = 0;
+#endif
+
+#if defined(CC_QUEUE)
+typedef struct
+{
+    uint8_t  buf[CC_PAYLOAD_SIZE_MANCH]; // as read from the FIFO
+#if defined(RFM69_RSSI)
+    uint8_t  rssi;
+#endif
+#if defined(CC_PREDICT)
+    uint16_t ticks;                      // when it arrived
+#endif
+} QUEUE_SLOT;
+
+static QUEUE_SLOT queue[CC_QUEUE];
+static uint8_t    queue_in       = 0; // next slot the radio fills
+static uint8_t    queue_out      = 0; // next slot to print
+static uint8_t    queue_count    = 0;
+static uint8_t    stat_overflows = 0; // frames lost to a full ring
+#if defined(RFM69_RSSI)
+static uint8_t    rx_rssi;            // of the frame being shown
+#define frame_rssi() (rx_rssi)
+#endif
+static void queue_drain(void);
+#else
+#define frame_rssi() rfm69_rssi()
+#endif
+
+//------------------------------------------------------------------------------
+// End an output line. With CC_QUEUE the radio is drained after each one,
+// as that is as long as it can be left while frames are being printed.
+
+#if defined(CC_QUEUE)
+static void end_line(void)
+{
+    ser_nl();
+    queue_drain();
+}
+#else
+#define end_line() ser_nl()
+#endif
+
+#if defined(CC_IDS)
+static const uint16_t cc_ids[] PROGMEM = {CC_IDS};
+#define CC_NUM_IDS (sizeof(cc_ids)/sizeof(cc_ids[0]))
+#endif
+
+#if defined(CC_SCAN)
+static const RFM69_CONFIG scan_configs[] = {CC_CONFIG, RFM69_CONFIG_OT_FSK};
+#define SCAN_NUM (sizeof(scan_configs)/sizeof(scan_configs[0]))
+
+static uint8_t scan_index = 0;
+static uint8_t scan_left  = CC_SCAN_CYCLE/SCAN_NUM; // seconds of this dwell left
+static uint8_t scan_dwell = CC_SCAN_CYCLE/SCAN_NUM; // length of this dwell
+static uint8_t scan_heard = 0;                      // good frames in this dwell
+static uint8_t scan_score[SCAN_NUM];                // good frames/s, decaying, *16
+#define radio_config() (scan_configs[scan_index])
+#else
+#define radio_config() (CC_CONFIG)
+#endif
+
+// The mode the radio waits in. With RFM69_LISTEN it sleeps between receive
+// windows by itself, with CC_TX rfm69_tx() switches to transmit and back.
+#if defined(CC_TX)
+#define RADIO_MODE RFM69_MODE_STBY
+#elif defined(RFM69_LISTEN)
+#define RADIO_MODE RFM69_MODE_LISTEN
+#else
+#define RADIO_MODE RFM69_MODE_RX
+#endif
+
+#if (RFM69_RADIOS > 1)
+#define radio_select(R) rfm69_select(R)
+#else
+#define radio_select(R)
+#endif
 
 //------------------------------------------------------------------------------
 static void show_watts(uint16_t watt[3])
@@ -42,160 +329,1763 @@ static void show_watts(uint16_t watt[3])
 }
 
 //------------------------------------------------------------------------------
-static void decode_payload(uint8_t * buf)
-{
-    // nybbles, in 8 bytes
-    // type:id id:id w1:w1 w1:w1 w2:w2 w2:w2 w3:w3 w3:w3
-    uint8_t type   = (buf[0] & 0xF0)>>4;
-    uint8_t id1    = buf[0] & 0x0F;
-    uint8_t id2    = buf[1];
-    uint16_t watt[3];
-    watt[0]        = (((uint16_t)buf[2])<<8) | buf[3]; // big-endian
-    watt[1]        = (((uint16_t)buf[4])<<8) | buf[5]; // big-endian
-    watt[2]        = (((uint16_t)buf[6])<<8) | buf[7]; // big-endian
+// RSSIVALUE is -dBm*2, shown in whole dBm
 
-    ser_txromstr(STR_DATA);
-    ser_hex(id1);
-    ser_hex(id2);
+#if defined(RFM69_RSSI) || defined(RFM69_NOISE)
+static void show_dbm(uint8_t rssi)
+{
     ser_tx(',');
+    ser_tx('-');
+    ser_u16(rssi/2);
+}
+#endif
 
-    switch (type)
+//------------------------------------------------------------------------------
+#if defined(CC_IDS)
+static bool id_wanted(uint16_t id)
+{
+    for (uint8_t i=0; i<CC_NUM_IDS; i++)
     {
-        case CC_TYPE_METER:
-            ser_txromstr(STR_METER);
-            show_watts(watt);
-        break;
+        if (pgm_read_word(&cc_ids[i]) == id)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
 
-        case CC_TYPE_PAIR:
-            ser_txromstr(STR_PAIR);
-            show_watts(watt);
-        break;
+//------------------------------------------------------------------------------
+// Receive prediction.
+// IAMs send METER frames at a steady period of about 6s, slightly
+// different for each one. Each IAM's period is learnt from the gaps
+// between its frames (a gap of several periods counts as several), and
+// its next frame is due one period after the last one heard. When the
+// window around that passes with nothing heard it counts as a miss, and
+// the next one is due a period later. All times are timer_ticks().
 
-        case CC_TYPE_COUNTER:
-            ser_txromstr(STR_COUNTER);
-            ser_tx(',');
-            ser_hexbuf(buf+2, 6); //TODO: decode as a U24?
-        break;
+#if defined(CC_PREDICT)
+#define PREDICT_FREE 0xFFFF
 
-        default:
-            ser_txromstr(STR_UNKNOWN);
-            ser_tx(',');
-            ser_hexbuf(buf, 8);
-        break;
+typedef struct
+{
+    uint16_t id;      // 12 bit IAM ID, or PREDICT_FREE
+    uint16_t last;    // when its last METER frame arrived
+    uint16_t period;  // learnt period, 0 until known
+    uint16_t heard;
+    uint16_t missed;
+    uint8_t  gap;     // misses since 'last'
+} PREDICT;
+
+static PREDICT  predict[CC_PREDICT_DEVICES];
+static uint16_t rx_ticks;  // when the frame being handled arrived
+
+static void predict_init(void)
+{
+    for (uint8_t i=0; i<CC_PREDICT_DEVICES; i++)
+    {
+        predict[i].id = PREDICT_FREE;
     }
-    ser_nl();
+}
+
+static uint16_t predict_due(PREDICT * p)
+{
+    return p->last + (p->period * (p->gap + 1));
+}
+
+static void predict_heard(uint16_t id, uint16_t now)
+{
+    PREDICT * p      = NULL;
+    uint16_t  oldest = 0;
+
+    // find it, or else take over the one heard from longest ago
+    for (uint8_t i=0; i<CC_PREDICT_DEVICES; i++)
+    {
+        PREDICT * q = &predict[i];
+        if (q->id == id)
+        {
+            p = q;
+            break;
+        }
+        uint16_t age = (q->id == PREDICT_FREE) ? 0xFFFF : now - q->last;
+        if (age >= oldest)
+        {
+            oldest = age;
+            p      = q;
+        }
+    }
+
+    if (p->id != id)
+    {
+        p->id     = id;
+        p->period = 0;
+        p->heard  = 0;
+        p->missed = 0;
+    }
+    else
+    {
+        uint16_t dt = now - p->last;
+
+        if (p->period == 0)
+        {   // first gap, if it is a sensible one
+            if ((dt > CC_PREDICT_NOMINAL*3/4) && (dt < CC_PREDICT_NOMINAL*5/4))
+            {
+                p->period = dt;
+            }
+        }
+        else
+        {
+            uint8_t n = (dt + (p->period/2)) / p->period; // periods since the last
+            if (n == 0)
+            {
+                return; // a repeat, timing stays with the first one
+            }
+            int16_t diff = (int16_t)(dt/n - p->period);
+            if ((diff < (int16_t)(p->period/8)) && (diff > -(int16_t)(p->period/8)))
+            {
+                p->period += diff/8;
+            }
+        }
+    }
+    p->last = now;
+    p->gap  = 0;
+    p->heard++;
 }
 
 //------------------------------------------------------------------------------
-static void setup(void)
+// Call often, counts and reports the misses once per tick.
+
+static void predict_check(void)
 {
-    timer_start();   // 1uS tick service
-    ser_as_tx();
-    spi_init(SPI_CPOL0|SPI_CPHA0|SPI_CSPOL1);
-    rfm69_init();
-    rfm69_setmode(RFM69_MODE_STBY);
-    rfm69_setconfig(RFM69_CONFIG_CC_FSK);
-    rfm69_setmode(RFM69_MODE_RX);
-    sei(); // enable interrupts
+    static uint16_t checked = 0;
+    uint16_t now = timer_ticks();
+
+    if (now == checked)
+    {
+        return;
+    }
+    checked = now;
+
+    for (uint8_t i=0; i<CC_PREDICT_DEVICES; i++)
+    {
+        PREDICT * p = &predict[i];
+        if ((p->id == PREDICT_FREE) || (p->period == 0))
+        {
+            continue;
+        }
+        if ((int16_t)(now - predict_due(p)) > CC_PREDICT_WINDOW)
+        {
+            p->gap++;
+            p->missed++;
+            ser_txromstr(STR_LOST);
+            ser_hex(p->id >> 8);
+            ser_hex(p->id & 0xFF);
+            ser_tx(',');
+            ser_u16(p->missed);
+            ser_tx(',');
+            ser_u16(p->heard);
+            end_line();
+            if (p->gap >= CC_PREDICT_FORGET)
+            {
+                p->id = PREDICT_FREE; // gone away, or moved out of range
+            }
+        }
+    }
 }
 
 //------------------------------------------------------------------------------
-static bool manch_is_valid(uint8_t * buf, uint8_t size)
+// true if any known IAM is due to send about now
+
+#if defined(CC_SCAN)
+static bool predict_window_open(void)
 {
-    // validate manchester bits as 5,6,9 or A (01 01, 01 10, 10 01, 10 10)
-    for (uint8_t i=0; i<sizeof(buf); i++)
+    uint16_t now = timer_ticks();
+
+    for (uint8_t i=0; i<CC_PREDICT_DEVICES; i++)
     {
-        // high nybble
-        uint8_t n = buf[i]>>4;
-        if ((n != 0x05) && (n != 0x06) && (n != 0x09) && (n != 0x0A))
+        PREDICT * p = &predict[i];
+        if ((p->id == PREDICT_FREE) || (p->period == 0))
         {
-            return false; // INVALID, early bail
+            continue;
         }
-        // low nybble
-        n = buf[i] & 0x0F;
-        if ((n != 0x05) && (n != 0x06) && (n != 0x09) && (n != 0x0A))
+        int16_t d = (int16_t)(now - predict_due(p));
+        if ((d >= -CC_PREDICT_WINDOW) && (d <= CC_PREDICT_WINDOW))
         {
-            return false; // INVALID, early bail
+            return true;
         }
     }
-    return true; // VALID
+    return false;
 }
+#endif
+#endif
 
 //------------------------------------------------------------------------------
-// produce a whole byte of output (8 bits) from 2 byes (16 bits)
-// first bit of a valid pair of bits is the actual data bit
-// 5 = 01 01   (00)
-// 6 = 01 10   (01)
-// 9 = 10 01   (10)
-// A = 10 10   (11)
-// each input byte (8 bits) produces 1 nybble of data bits (4 bits)
+// Device table, see CC_DEVICES.
+// Open addressing on the low bits of the ID (random, so they spread well),
+// stepping on to the next entry when one is taken. Entries are never
+// emptied, only taken over once the table is full, so a search can stop
+// at the first free entry. Times are timer_ticks(), which wrap every 655s,
+// so an IAM not heard for longer than that can look recent.
+
+#if defined(CC_DEVICES)
+#define DEVICE_FREE 0xFFFF
+
+typedef struct
+{
+    uint16_t id;      // 12 bit IAM ID, or DEVICE_FREE
+    uint16_t watt[3]; // last readings, as sent, valid bit and all
+    uint16_t last;    // when its last good frame was shown
+    uint16_t frames;  // good frames
+    uint16_t errors;  // frames with its ID that failed to decode
+    uint8_t  rssi;    // of its last good frame, -dBm*2, 0 without RFM69_RSSI
+#if defined(CC_DEADBAND)
+    uint16_t sent[3]; // readings last shown
+    uint16_t sent_at; // when they were shown
+#endif
+#if defined(CC_WINDOW)
+    uint16_t min;     // watt1 over this window
+    uint16_t max;
+    uint32_t sum;
+    uint16_t count;   // readings in this window, 0 for none
+#endif
+} DEVICE;
+
+static DEVICE devices[CC_DEVICES];
 
-static uint8_t manch_extract(uint8_t * buf)
+static void device_init(void)
 {
-    uint8_t in;
-    uint8_t out;
+    for (uint8_t i=0; i<CC_DEVICES; i++)
+    {
+        devices[i].id = DEVICE_FREE;
+    }
+}
 
-    // extract 4 bits from even byte A.B.C.D. into high nybble ABCD....
-    in  = buf[0];
-    out = (in & 0x80) | ((in & 0x20)<<1) | ((in & 0x08)<<2) | ((in & 0x02)<<3);
+//------------------------------------------------------------------------------
+// returns: the entry for 'id', or NULL if it is not in the table
 
-    // extract 4 bits from odd byte E.F.G.H. into low nybble   ....EFGH
-    in = buf[1];
-    out |= ((in & 0x80)>>4) | ((in & 0x20)>>3) | ((in & 0x08)>>2) | ((in & 0x02) >> 1);
+static DEVICE * device_find(uint16_t id)
+{
+    uint8_t h = id & (CC_DEVICES-1);
 
-    return out;
+    for (uint8_t n=0; n<CC_DEVICES; n++)
+    {
+        DEVICE * d = &devices[h];
+        if ((d->id == id) || (d->id == DEVICE_FREE))
+        {
+            return (d->id == id) ? d : NULL;
+        }
+        h = (h+1) & (CC_DEVICES-1);
+    }
+    return NULL;
 }
 
 //------------------------------------------------------------------------------
-// decode manchester bits in-place into first half of buf
+// returns: the entry for 'id', added if it is new
 
-static void manch_decode(uint8_t * buf, uint8_t size)
+static DEVICE * device_add(uint16_t id)
 {
-    for (uint8_t w=0; w<size/2; w++)
+    uint16_t now    = timer_ticks();
+    uint16_t oldest = 0;
+    DEVICE * d      = NULL;
+    uint8_t  h      = id & (CC_DEVICES-1);
+
+    for (uint8_t n=0; n<CC_DEVICES; n++)
+    {
+        DEVICE * q = &devices[h];
+        if ((q->id == id) || (q->id == DEVICE_FREE))
+        {
+            d = q;
+            break;
+        }
+        uint16_t age = now - q->last;
+        if (age >= oldest)
+        {   // full so far, take over the one heard from longest ago
+            oldest = age;
+            d      = q;
+        }
+        h = (h+1) & (CC_DEVICES-1);
+    }
+
+    if (d->id != id)
     {
-        buf[w] = manch_extract(buf+(w*2));
+        memset(d, 0, sizeof(DEVICE));
+        d->id = id;
     }
+    return d;
 }
 
 //------------------------------------------------------------------------------
-static void loop(void)
+static DEVICE * device_heard(uint16_t id, uint8_t type, uint16_t watt[3])
 {
-    uint8_t buf[CC_PAYLOAD_SIZE_MANCH];
-    if (RFM69_RESULT_I_READY == rfm69_receive_waiting())
+    DEVICE * d = device_add(id);
+
+    memcpy(d->watt, watt, sizeof(d->watt));
+    d->last = timer_ticks();
+    d->frames++;
+#if defined(RFM69_RSSI)
+    d->rssi = frame_rssi();
+#endif
+#if defined(CC_WINDOW)
+    if (((type == CC_TYPE_METER) || (type == CC_TYPE_PAIR)) && (watt[0] & 0x8000))
     {
-        if (RFM69_RESULT_OK == rfm69_rx(buf, sizeof(buf)))
-        { // DECODE
-#if defined(DEBUG)
-            ser_txromstr(STR_RAW);
-            ser_hexbuf(buf, sizeof(buf));
-            ser_nl();
+        uint16_t w = watt[0] & 0x7FFF;
+        if ((d->count == 0) || (w < d->min)) d->min = w;
+        if ((d->count == 0) || (w > d->max)) d->max = w;
+        d->sum += w;
+        d->count++;
+    }
+#else
+    (void)type; // only for CC_WINDOW
 #endif
+    return d;
+}
+
+//------------------------------------------------------------------------------
+// Report by exception, see CC_DEADBAND. Readings are compared with the
+// ones last shown, not the last heard, so a slow drift is still shown once
+// it adds up to more than the deadband.
+// returns: true if the frame should be shown, and it is then the one
+// that later frames are compared with
+
+#if defined(CC_DEADBAND)
+#define HEARTBEAT_TICKS ((uint16_t)(CC_HEARTBEAT*(1000UL/TIMER_TICK_MS))) // int is 16 bits
+
+static bool device_changed(DEVICE * d, uint16_t watt[3])
+{
+    uint16_t now     = timer_ticks();
+    bool     changed = (d->frames == 1) // new to the table
+        || ((uint16_t)(now - d->sent_at) >= HEARTBEAT_TICKS);
+
+    for (uint8_t i=0; i<3; i++)
+    {
+        uint16_t was = d->sent[i];
+        uint16_t is  = watt[i];
 
-            if (! manch_is_valid(buf, sizeof(buf)))
+        if ((was ^ is) & 0x8000)
+        {
+            changed = true; // became valid or invalid
+        }
+        else if (is & 0x8000)
+        {
+            was &= 0x7FFF;
+            is  &= 0x7FFF;
+            uint16_t diff = (is > was) ? (is - was) : (was - is);
+            if (((CC_DEADBAND_W != 0) && (diff > CC_DEADBAND_W))
+                || ((CC_DEADBAND_PCT != 0)
+                    && (((uint32_t)diff * 100) > ((uint32_t)was * CC_DEADBAND_PCT))))
             {
-#if defined(DEBUG)
-                ser_txromstr(STR_ERR_BAD_MANCH);
-                ser_hexbuf(buf, sizeof(buf));
-                ser_nl();
-#endif
+                changed = true;
             }
-            else // valid
-            {
-                // decode manchester bits in-place into first half of buf
-                manch_decode(buf, sizeof(buf));
-
-#if defined(DEBUG)
-                // dump new payload
-                ser_txromstr(STR_OK_BUF);
-                ser_hexbuf(buf, sizeof(buf)/2);
-                ser_nl();
+        }
+    }
+    if (changed)
+    {
+        memcpy(d->sent, watt, sizeof(d->sent));
+        d->sent_at = now;
+    }
+    return changed;
+}
 #endif
-                decode_payload(buf); // friendly CSV decode
-            }
+
+//------------------------------------------------------------------------------
+// A frame failed to decode, but its ID was readable. It only counts against
+// an IAM already in the table, as noise must not push real ones out.
+
+static void device_error(uint16_t id)
+{
+    DEVICE * d = device_find(id);
+
+    if (d != NULL)
+    {
+        d->errors++;
+    }
+}
+
+//------------------------------------------------------------------------------
+static void device_show(void)
+{
+    uint16_t now = timer_ticks();
+
+    for (uint8_t i=0; i<CC_DEVICES; i++)
+    {
+        DEVICE * d = &devices[i];
+        if (d->id == DEVICE_FREE)
+        {
+            continue;
         }
+        ser_txromstr(STR_DEV);
+        ser_hex(d->id >> 8);
+        ser_hex(d->id & 0xFF);
+        ser_tx(',');
+        ser_u16(d->frames);
+        ser_tx(',');
+        ser_u16(d->errors);
+        ser_tx(',');
+        ser_u16((uint16_t)(now - d->last) / (1000/TIMER_TICK_MS));
+#if defined(RFM69_RSSI)
+        show_dbm(d->rssi);
+#endif
+        end_line();
     }
 }
 
+//------------------------------------------------------------------------------
+// Call often. At the end of each window, shows the statistics for every IAM
+// heard in it and starts them again. The mean is worked in tenths of a
+// watt, rounded, which fits in 32 bits for any window up to 600s.
+
+#if defined(CC_WINDOW)
+#define WINDOW_TICKS ((uint16_t)(CC_WINDOW*(1000UL/TIMER_TICK_MS))) // int is 16 bits
+
+static void window_check(void)
+{
+    static uint16_t start = 0;
+    uint16_t now = timer_ticks();
+
+    if ((uint16_t)(now - start) < WINDOW_TICKS)
+    {
+        return;
+    }
+    start += WINDOW_TICKS; // stays in step if this is late
+
+    for (uint8_t i=0; i<CC_DEVICES; i++)
+    {
+        DEVICE * d = &devices[i];
+        if ((d->id == DEVICE_FREE) || (d->count == 0))
+        {
+            continue;
+        }
+        uint32_t mean10 = ((d->sum * 10) + (d->count / 2)) / d->count;
+
+        ser_txromstr(STR_WIN);
+        ser_hex(d->id >> 8);
+        ser_hex(d->id & 0xFF);
+        ser_tx(',');
+        ser_u16(d->count);
+        ser_tx(',');
+        ser_u16(d->min);
+        ser_tx(',');
+        ser_u16(mean10 / 10);
+        ser_tx('.');
+        ser_tx('0' + (mean10 % 10));
+        ser_tx(',');
+        ser_u16(d->max);
+        end_line();
+        d->sum   = 0;
+        d->count = 0;
+    }
+}
+#endif
+#endif
+
+//------------------------------------------------------------------------------
+// Frame repair checks, see CC_REPAIR.
+// Only frames that decoded cleanly add their ID to cc_recent, so a repaired
+// frame can never vouch for another one.
+
+#if defined(CC_REPAIR)
+static void cc_seen(uint16_t id)
+{
+    for (uint8_t i=0; i<CC_REPAIR_IDS; i++)
+    {
+        if (cc_recent[i] == id)
+        {
+            return;
+        }
+    }
+    cc_recent[cc_recent_next] = id;
+    cc_recent_next = (cc_recent_next+1 < CC_REPAIR_IDS) ? cc_recent_next+1 : 0;
+}
+
+static bool cc_consistent(uint8_t * buf)
+{
+    uint8_t  type = buf[0]>>4;
+    uint16_t id   = (((uint16_t)(buf[0] & 0x0F))<<8) | buf[1];
+    bool     seen = false;
+
+    for (uint8_t i=0; i<CC_REPAIR_IDS; i++)
+    {
+        seen |= (cc_recent[i] == id);
+    }
+    if ((! seen) || (id == 0)) // cc_recent starts as zeros
+    {
+        return false;
+    }
+    if (type == CC_TYPE_COUNTER)
+    {
+        return true;
+    }
+    if ((type != CC_TYPE_METER) && (type != CC_TYPE_PAIR))
+    {
+        return false;
+    }
+    if ((buf[2] & 0x80) == 0)
+    {
+        return false; // watt1 is always valid
+    }
+    for (uint8_t i=4; i<8; i+=2)
+    {   // an invalid reading should be all zeros
+        if (((buf[i] & 0x80) == 0) && ((buf[i] != 0) || (buf[i+1] != 0)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Current Cost formatter, 'buf' is the 8 decoded bytes.
+// With CC_REPAIR, buf[CC_REPAIRED] says if the frame was repaired. It is
+// kept with the frame, as two radios' frames can be decoded before either
+// is shown.
+
+static void cc_show(uint8_t * buf, uint8_t len)
+{
+    (void)len; // always CC_PAYLOAD_SIZE
+
+    // nybbles, in 8 bytes
+    // type:id id:id w1:w1 w1:w1 w2:w2 w2:w2 w3:w3 w3:w3
+    uint8_t type   = (buf[0] & 0xF0)>>4;
+    uint8_t id1    = buf[0] & 0x0F;
+    uint8_t id2    = buf[1];
+    uint16_t watt[3];
+    watt[0]        = (((uint16_t)buf[2])<<8) | buf[3]; // big-endian
+    watt[1]        = (((uint16_t)buf[4])<<8) | buf[5]; // big-endian
+    watt[2]        = (((uint16_t)buf[6])<<8) | buf[7]; // big-endian
+
+#if defined(CC_IDS)
+    if (! id_wanted((((uint16_t)id1)<<8) | id2))
+    {
+        return;
+    }
+#endif
+#if defined(CC_PREDICT)
+    if (type == CC_TYPE_METER)
+    {
+        predict_heard((((uint16_t)id1)<<8) | id2, rx_ticks);
+    }
+#endif
+#if defined(CC_REPAIR)
+    if (! buf[CC_REPAIRED])
+    {
+        cc_seen((((uint16_t)id1)<<8) | id2);
+    }
+#endif
+#if defined(CC_DEADBAND)
+    DEVICE * d = device_heard((((uint16_t)id1)<<8) | id2, type, watt);
+    if ((type == CC_TYPE_METER) && ! device_changed(d, watt))
+    {
+        return; // nothing new to say
+    }
+#elif defined(CC_DEVICES)
+    device_heard((((uint16_t)id1)<<8) | id2, type, watt);
+#endif
+#if defined(CC_REPAIR)
+    ser_txromstr(buf[CC_REPAIRED] ? STR_FIX : STR_DATA);
+#else
+    ser_txromstr(STR_DATA);
+#endif
+    ser_hex(id1);
+    ser_hex(id2);
+    ser_tx(',');
+
+    switch (type)
+    {
+        case CC_TYPE_METER:
+            ser_txromstr(STR_METER);
+            show_watts(watt);
+        break;
+
+        case CC_TYPE_PAIR:
+            ser_txromstr(STR_PAIR);
+            show_watts(watt);
+        break;
+
+        case CC_TYPE_COUNTER:
+            ser_txromstr(STR_COUNTER);
+            ser_tx(',');
+            ser_hexbuf(buf+2, 6); //TODO: decode as a U24?
+        break;
+
+        default:
+            ser_txromstr(STR_UNKNOWN);
+            ser_tx(',');
+            ser_hexbuf(buf, 8);
+        break;
+    }
+#if defined(RFM69_RSSI)
+    show_dbm(frame_rssi());
+#endif
+    end_line();
+}
+
+//------------------------------------------------------------------------------
+// Decoded payloads that are not one of the known frame types, or a meter
+// or pair frame without a valid first watt reading, are almost always
+// noise that happened to make it through the manchester decoder.
+
+#if (CC_CONFIG == RFM69_CONFIG_CC_FSK_MANCH)
+static bool payload_is_plausible(uint8_t * buf, uint8_t len)
+{
+    (void)len; // always CC_PAYLOAD_SIZE
+
+    uint8_t type = (buf[0] & 0xF0)>>4;
+
+    if (type == CC_TYPE_COUNTER)
+    {
+        return true;
+    }
+    if (((type == CC_TYPE_METER) || (type == CC_TYPE_PAIR)) && (buf[2] & 0x80)) // watt1 valid bit
+    {
+        return true;
+    }
+#if defined(CC_DEVICES)
+    device_error(CC_ID(buf));
+#endif
+    return false;
+}
+#endif
+
+//------------------------------------------------------------------------------
+static void show_stats(void)
+{
+    ser_txromstr(STR_MSTAT);
+    ser_u16(stat_frames);
+    ser_tx(',');
+    ser_u16(stat_rejects);
+#if defined(RFM69_FEI)
+    int16_t offset = rfm69_fei_offset();
+    ser_tx(',');
+    if (offset < 0) {ser_tx('-'); offset = -offset;}
+    ser_u16(offset * RFM69_FSTEP_HZ);
+#endif
+#if defined(RFM69_NOISE)
+    show_dbm(rfm69_noise_floor());
+    show_dbm(rfm69_rssi_thresh());
+#endif
+#if defined(CC_REPAIR)
+    ser_tx(',');
+    ser_u16(stat_repairs);
+    stat_repairs = 0;
+#endif
+#if defined(CC_QUEUE)
+    ser_tx(',');
+    ser_u16(stat_overflows);
+    stat_overflows = 0;
+#endif
+    stat_frames  = 0;
+    stat_rejects = 0;
+    end_line();
+#if defined(CC_DEVICES)
+    device_show();
+#endif
+}
+
+//------------------------------------------------------------------------------
+static void count_frame(bool rejected)
+{
+    stat_frames++;
+    if (rejected)
+    {
+        stat_rejects++;
+    }
+    else
+    {   // a good frame
+#if defined(CC_SCAN)
+        scan_heard++;
+#endif
+#if defined(RFM69_FEI)
+        rfm69_fei_track();
+#endif
+    }
+
+    if (stat_frames >= CC_STATS_EVERY)
+    {
+        show_stats();
+    }
+}
+
+//------------------------------------------------------------------------------
+// The radio's address filter checks the first decoded byte, type:id1, and
+// allows two values, so it can take meter and pair frames for one top
+// nybble of the ID. If CC_IDS span more than one, it is left off.
+// COUNTER frames do not get through it, so it is not used when
+// CC_IDS_COUNTER asks for them.
+
+#if defined(CC_ID_FILTER)
+static void setup_id_filter(void)
+{
+    if (rfm69_getconfig() != CC_CONFIG)
+    {
+        return; // scanning, and on some other config
+    }
+    uint8_t id1 = pgm_read_word(&cc_ids[0]) >> 8;
+
+    for (uint8_t i=1; i<CC_NUM_IDS; i++)
+    {
+        if ((pgm_read_word(&cc_ids[i]) >> 8) != id1)
+        {
+            return; // software filter only
+        }
+    }
+    rfm69_setaddress((CC_TYPE_METER<<4) | id1, (CC_TYPE_PAIR<<4) | id1);
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Report a radio fault, as a RADIO:result[,radio] line.
+
+static void radio_report(RFM69_RESULT result, uint8_t r)
+{
+    ser_txromstr(STR_RADIO);
+    ser_hex(result);
+#if (RFM69_RADIOS > 1)
+    ser_tx(',');
+    ser_u16(r);
+#else
+    (void)r; // only with two radios
+#endif
+    end_line();
+}
+
+//------------------------------------------------------------------------------
+// Load the current config into the selected radio and set it receiving.
+// If the registers do not read back as written, report it and write the
+// whole config once more. rfm69_health() does not look at the config,
+// so this is the only place a bad load is caught.
+
+static void radio_configure(uint8_t r)
+{
+    rfm69_setmode(RFM69_MODE_STBY);
+    RFM69_RESULT result = rfm69_setconfig(radio_config());
+    if (RFM69_RESULT_OK != result)
+    {
+        radio_report(result, r);
+        result = rfm69_setconfig(radio_config());
+        if (RFM69_RESULT_OK != result)
+        {
+            radio_report(result, r);
+        }
+    }
+    rfm69_setmode(RADIO_MODE);
+}
+
+//------------------------------------------------------------------------------
+// Get the radios listening, from whatever state they are in.
+
+static void radio_start(void)
+{
+    for (uint8_t r=0; r<RFM69_RADIOS; r++)
+    {
+        radio_select(r);
+        rfm69_init();
+        if (RFM69_RESULT_OK != rfm69_warmstart(radio_config(), RADIO_MODE))
+        {
+            radio_configure(r);
+        }
+#if defined(RFM69_STREAM)
+        rfm69_setpayloadlen(CC_STREAM_LEN);
+#endif
+#if defined(CC_ID_FILTER)
+        setup_id_filter();
+#endif
+    }
+}
+
+//------------------------------------------------------------------------------
+// Config scanning, called once a second.
+// Each config is listened to for a share of CC_SCAN_CYCLE in proportion to
+// how many good frames a second it has been giving, so a site with mostly
+// one kind of transmitter spends most of its time on that one. Every
+// config keeps CC_SCAN_MIN, so that new transmitters are still found.
+// The rate is per second of dwell, otherwise a long dwell would hear more
+// and so get longer still.
+
+#if defined(CC_SCAN)
+static uint8_t scan_share(uint8_t index)
+{
+    uint16_t total = 0;
+    for (uint8_t i=0; i<SCAN_NUM; i++)
+    {
+        total += scan_score[i];
+    }
+    if (total == 0)
+    {
+        return CC_SCAN_CYCLE / SCAN_NUM; // nothing heard yet, share equally
+    }
+    return CC_SCAN_MIN + ((CC_SCAN_CYCLE - (SCAN_NUM*CC_SCAN_MIN)) * scan_score[index]) / total;
+}
+
+static void scan_goto(uint8_t index)
+{
+    // fold this dwell into its score, older dwells count for less
+    uint8_t  elapsed = (scan_dwell > scan_left) ? scan_dwell - scan_left : 1;
+    uint8_t  score   = scan_score[scan_index];
+    uint16_t rate    = (scan_heard * 16) / elapsed;
+    score -= score/4;
+    scan_score[scan_index] = (score + rate > 255) ? 255 : score + rate;
+    scan_heard = 0;
+
+    scan_index = index;
+    scan_dwell = scan_share(scan_index);
+    scan_left  = scan_dwell;
+
+    for (uint8_t r=0; r<RFM69_RADIOS; r++)
+    {
+        radio_select(r);
+        radio_configure(r);
+#if defined(CC_ID_FILTER)
+        setup_id_filter();
+#endif
+    }
+}
+
+static void scan_tick(void)
+{
+    if (--scan_left != 0)
+    {
+        return;
+    }
+#if defined(CC_PREDICT)
+    if ((scan_index == 0) && predict_window_open())
+    {
+        scan_left = 1; // an IAM is due, stay on CC for now
+        return;
+    }
+#endif
+    scan_goto((scan_index+1 < SCAN_NUM) ? scan_index+1 : 0);
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Watchdog supervisor.
+// The watchdog runs in interrupt-then-reset mode with a 1s period. The first
+// timeout just fires the (empty) interrupt, which clears WDIE and wakes the
+// CPU if it is asleep, and supervise() sees WDIE clear, re-arms it and checks
+// the radio. If the loop is stuck and never gets back here, the second
+// timeout resets the MCU. So, going by the nominal 1s watchdog period:
+//   radio reset or not responding: restarted within 1s (plus a few ms)
+//   MCU stuck: reset within 2s, and setup() restarts the radio
+// Radio waits in rfm69.c are all bounded well inside that.
+
+#if defined(CC_SUPERVISOR)
+EMPTY_INTERRUPT(WDT_vect);
+
+static void supervise(void)
+{
+    if (WDTCR & (1<<WDIE))
+    {
+        return; // not due yet
+    }
+    wdt_reset();
+    WDTCR |= (1<<WDIE);
+
+    for (uint8_t r=0; r<RFM69_RADIOS; r++)
+    {
+        radio_select(r);
+        RFM69_RESULT result = rfm69_health();
+        if (RFM69_RESULT_OK != result)
+        {
+            radio_report(result, r);
+            radio_start();
+            break;
+        }
+    }
+#if defined(CC_SCAN)
+    scan_tick();
+#endif
+}
+#endif
+
+//------------------------------------------------------------------------------
+static void setup(void)
+{
+#if defined(CC_SUPERVISOR)
+    // a watchdog reset leaves the watchdog running, at its shortest period
+    bool wdt_reset_seen = (MCUSR & (1<<WDRF)) != 0;
+    MCUSR = 0;
+    wdt_enable(WDTO_1S);
+    WDTCR |= (1<<WDIE);
+#endif
+
+    timer_start();   // 1uS tick service
+#if defined(CC_PREDICT)
+    timer_clock_start();
+    predict_init();
+#endif
+#if defined(CC_TX)
+    timer_clock_start();
+#endif
+#if defined(CC_DEVICES)
+    timer_clock_start();
+    device_init();
+#endif
+    ser_as_tx();
+    spi_init(SPI_MODE);
+#if defined(CC_SUPERVISOR)
+    if (wdt_reset_seen)
+    {
+        ser_txromstr(STR_WDT_RESET);
+        ser_nl();
+    }
+#endif
+    radio_start();
+#if defined(RFM69_LISTEN)
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN); // only DIO0 and the watchdog wake it
+#elif defined(RFM69_IRQ)
+    set_sleep_mode(SLEEP_MODE_IDLE); // timer keeps running for ser_tx
+#endif
+    sei(); // enable interrupts
+}
+
+//------------------------------------------------------------------------------
+// Idle the CPU until DIO0 says the radio has something for us.
+// With RFM69_LISTEN the CPU is powered down instead, which is safe because
+// ser_tx() has always finished by the time we get here.
+// Interrupts are held off across the test, so that the edge cannot slip in
+// between the test and the sleep (sei always runs the next instruction).
+
+#if defined(RFM69_STREAM)
+#define radio_waiting() rfm69_sync_waiting()     // start of packet
+#else
+#define radio_waiting() rfm69_receive_waiting()  // end of packet
+#endif
+
+#if defined(RFM69_IRQ)
+static void wait_radio(void)
+{
+    cli();
+    if (RFM69_RESULT_I_READY != radio_waiting())
+    {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+}
+#endif
+
+#if (CC_CONFIG == RFM69_CONFIG_CC_FSK)
+//------------------------------------------------------------------------------
+// Manchester symbols, one nybble is two data bits, the first bit of each
+// valid pair of bits is the data bit:
+// 5 = 01 01   (00)
+// 6 = 01 10   (01)
+// 9 = 10 01   (10)
+// A = 10 10   (11)
+// anything else has a 00 or 11 pair in it, so is not manchester at all.
+
+#define MANCH_BAD 0x80
+
+static const uint8_t manch_bits[16] PROGMEM =
+{
+    MANCH_BAD, MANCH_BAD, MANCH_BAD, MANCH_BAD,
+    MANCH_BAD, 0x00,      0x01,      MANCH_BAD,
+    MANCH_BAD, 0x02,      0x03,      MANCH_BAD,
+    MANCH_BAD, MANCH_BAD, MANCH_BAD, MANCH_BAD
+};
+
+//------------------------------------------------------------------------------
+#if !defined(RFM69_STREAM) && !defined(CC_REPAIR)
+static bool manch_is_valid(uint8_t * buf, uint8_t size)
+{
+    for (uint8_t i=0; i<size; i++)
+    {
+        uint8_t b = buf[i];
+        if ((pgm_read_byte(&manch_bits[b>>4]) | pgm_read_byte(&manch_bits[b & 0x0F])) & MANCH_BAD)
+        {
+            return false; // INVALID, early bail
+        }
+    }
+    return true; // VALID
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Validate and decode in one pass, each input byte (8 bits) produces one
+// nybble of data bits (4 bits), and the first bad symbol stops it.
+// 'out' can be 'in', as it never gets ahead of it.
+// returns: the decoded length, or 0 if it was not all valid manchester
+//
+// A 16 byte frame takes about 440 cycles (55us at 8MHz) to check and decode
+// all of it. The four compares per nybble and the separate decode pass
+// before took about 520, but only checked the first 2 bytes (sizeof on a
+// pointer), and would have taken about 850 to check them all. These are
+// worked out from the AVR instruction timings, not measured.
+
+static uint8_t manch_decode_to(uint8_t * out, uint8_t * in, uint8_t size)
+{
+    for (uint8_t w=0; w<size/2; w++)
+    {
+        uint8_t data = 0;
+        for (uint8_t i=0; i<2; i++)
+        {
+            uint8_t b  = *in++;
+            uint8_t hi = pgm_read_byte(&manch_bits[b>>4]);
+            uint8_t lo = pgm_read_byte(&manch_bits[b & 0x0F]);
+            if ((hi | lo) & MANCH_BAD)
+            {
+                return 0;
+            }
+            data = (data<<4) | (hi<<2) | lo;
+        }
+        out[w] = data;
+    }
+    return size/2;
+}
+
+//------------------------------------------------------------------------------
+// decode manchester bits in-place into first half of buf
+// returns: the decoded length, 0 if it was not valid
+
+#if !defined(RFM69_STREAM) && !defined(CC_REPAIR) && !defined(CC_DEVICES)
+static uint8_t manch_decode(uint8_t * buf, uint8_t size)
+{
+    return manch_decode_to(buf, buf, size);
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Tolerant decode for CC_REPAIR. Each pair of bits is 01 (0) or 10 (1),
+// a 00 or 11 is one bit flipped from either, so there is no telling which,
+// and its data bit is left as 0 with its position put in 'pos'.
+// 'out' must start as zeros.
+// returns: the number of unreadable bits, or MANCH_BAD if more than
+// CC_REPAIR_BITS
+
+#if defined(CC_REPAIR)
+static uint8_t manch_decode_tolerant(uint8_t * out, uint8_t * in, uint8_t size, uint8_t * pos)
+{
+    uint8_t unknown = 0;
+    uint8_t bit     = 0;
+
+    for (uint8_t i=0; i<size; i++)
+    {
+        uint8_t b = in[i];
+        for (uint8_t j=0; j<4; j++, bit++)
+        {
+            uint8_t pair = b>>6;
+            b <<= 2;
+            if (pair == 0x02)
+            {
+                out[bit/8] |= (0x80 >> (bit & 7));
+            }
+            else if (pair != 0x01)
+            {
+                if (unknown == CC_REPAIR_BITS)
+                {
+                    return MANCH_BAD;
+                }
+                pos[unknown++] = bit;
+            }
+        }
+    }
+    return unknown;
+}
+
+//------------------------------------------------------------------------------
+// Early check, lets through frames that might be repairable
+
+static bool manch_is_repairable(uint8_t * buf, uint8_t size)
+{
+    uint8_t out[CC_PAYLOAD_SIZE] = {0};
+    uint8_t pos[CC_REPAIR_BITS];
+    return manch_decode_tolerant(out, buf, size, pos) != MANCH_BAD;
+}
+
+//------------------------------------------------------------------------------
+// Set the unreadable bits listed in 'pos' from the bits of 'value'
+
+static void manch_set_bits(uint8_t * out, uint8_t * pos, uint8_t unknown, uint8_t value)
+{
+    for (uint8_t k=0; k<unknown; k++)
+    {
+        uint8_t mask = 0x80 >> (pos[k] & 7);
+        if (value & (1<<k))
+        {
+            out[pos[k]/8] |= mask;
+        }
+        else
+        {
+            out[pos[k]/8] &= ~mask;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Try every value of the unreadable bits, and keep the frame only if
+// exactly one of them passes cc_consistent(). If more than one does, there
+// is no way to know which was sent, so it is still rejected.
+// returns: the decoded length, 0 if it could not be repaired
+
+static uint8_t cc_repair(uint8_t * buf, uint8_t size)
+{
+    uint8_t out[CC_PAYLOAD_SIZE] = {0};
+    uint8_t pos[CC_REPAIR_BITS];
+    uint8_t unknown = manch_decode_tolerant(out, buf, size, pos);
+    uint8_t found   = 0;
+    uint8_t good    = 0;
+
+    if (unknown == MANCH_BAD)
+    {
+        return 0;
+    }
+    for (uint8_t c=0; c < (1<<unknown); c++)
+    {
+        manch_set_bits(out, pos, unknown, c);
+        if (cc_consistent(out))
+        {
+            found++;
+            good = c;
+        }
+    }
+    if (found != 1)
+    {
+        return 0;
+    }
+    manch_set_bits(out, pos, unknown, good);
+    memcpy(buf, out, CC_PAYLOAD_SIZE);
+    buf[CC_REPAIRED] = true;
+    stat_repairs++;
+    return CC_PAYLOAD_SIZE;
+}
+
+#endif
+
+//------------------------------------------------------------------------------
+// Protocol table decode with CC_REPAIR or CC_DEVICES. The raw frame is kept
+// until it is known to be good, in case it needs repairing, or its ID is
+// wanted to count the error against.
+
+#if (defined(CC_REPAIR) || defined(CC_DEVICES)) && !defined(RFM69_STREAM)
+static uint8_t cc_decode(uint8_t * buf, uint8_t size)
+{
+    uint8_t out[CC_PAYLOAD_SIZE];
+
+    if (0 != manch_decode_to(out, buf, size))
+    {
+        memcpy(buf, out, CC_PAYLOAD_SIZE);
+#if defined(CC_REPAIR)
+        buf[CC_REPAIRED] = false;
+#endif
+        return CC_PAYLOAD_SIZE;
+    }
+#if defined(CC_REPAIR)
+    if (0 != cc_repair(buf, size))
+    {
+        return CC_PAYLOAD_SIZE;
+    }
+#endif
+#if defined(CC_DEVICES)
+    if (0 != manch_decode_to(out, buf, 4)) // type:id id:id
+    {
+        device_error(CC_ID(out));
+    }
+#endif
+    return 0;
+}
+#endif
+#endif
+
+//------------------------------------------------------------------------------
+// Streaming receive.
+// Each chunk is validated and decoded as soon as it comes out of the FIFO,
+// while the rest of the packet is still on air, and the first bad symbol
+// abandons the packet.
+// radio_start() sets the radio's packet length to CC_STREAM_LEN, the
+// number of bytes read here, rather than leaving it to the config.
+// rfm69_setpayloadlen() puts the radio in unlimited length mode for more
+// than 255, and the FIFO size is no limit when streaming, but CC frames
+// are only 16 bytes, so that path is not used by this program.
+
+#if defined(RFM69_STREAM)
+#if (RFM69_STREAM_CHUNK & 1)
+#error "stream_chunk() needs whole manchester pairs"
+#endif
+
+static uint8_t stream_raw[CC_STREAM_LEN];
+static uint8_t stream_payload[CC_STREAM_LEN/2];
+static uint8_t stream_len;
+
+static bool stream_chunk(uint8_t * pchunk, uint8_t len)
+{
+    for (uint8_t i=0; i<len; i+=2)
+    {
+        uint8_t * praw = stream_raw + stream_len;
+        praw[0] = pchunk[i];
+        praw[1] = pchunk[i+1];
+
+        stream_len += 2;
+
+        if (0 == manch_decode_to(stream_payload + (stream_len/2) - 1, praw, 2))
+        {
+            return false; // the rest is junk, stop reading
+        }
+    }
+    return true;
+}
+
+static void receive_stream(void)
+{
+    stream_len = 0;
+    RFM69_RESULT result = rfm69_rxstream(CC_STREAM_LEN, stream_chunk);
+
+#if defined(DEBUG)
+    ser_txromstr(STR_RAW);
+    ser_hexbuf(stream_raw, stream_len);
+    ser_nl();
+#endif
+
+    count_frame(RFM69_RESULT_OK != result);
+    if (RFM69_RESULT_OK != result)
+    {
+#if defined(CC_DEVICES)
+        if (stream_len >= 6)
+        {   // type:id and id:id decoded before the bad pair
+            device_error(CC_ID(stream_payload));
+        }
+#endif
+#if defined(DEBUG)
+        ser_txromstr(STR_ERR_BAD_MANCH);
+        ser_hexbuf(stream_raw, stream_len);
+        ser_nl();
+#endif
+        return;
+    }
+
+#if defined(DEBUG)
+    // dump new payload
+    ser_txromstr(STR_OK_BUF);
+    ser_hexbuf(stream_payload, sizeof(stream_payload));
+    ser_nl();
+#endif
+    cc_show(stream_payload, sizeof(stream_payload)); // friendly CSV decode
+}
+#endif
+
+//------------------------------------------------------------------------------
+// OpenThings formatter, the payload is encrypted so it is only shown.
+
+#if defined(CC_SCAN)
+static void ot_show(uint8_t * buf, uint8_t len)
+{
+    ser_txromstr(STR_OT);
+    ser_u16(len);
+    ser_tx(',');
+    ser_hexbuf(buf, len);
+    ser_nl();
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Protocol table, one entry per radio config that the app can be on.
+// A new sensor family is a new radio config plus an entry here.
+// The entry for the current config is copied out of flash when the config
+// changes, so per packet there is only one compare to find it.
+//   len:    bytes per frame in the FIFO, 0 for a length byte first
+//   early:  bytes 'valid' checks before the rest is read, 0 for none
+//   valid:  rejects junk, NULL takes anything. With a decode it only does
+//           the early check, as decode checks the whole frame anyway
+//   decode: in place, returns the new length or 0 to reject the frame,
+//           NULL if there is nothing to do
+//   show:   prints the frame
+
+#if !defined(RFM69_STREAM)
+typedef struct
+{
+    RFM69_CONFIG config;
+    uint8_t      len;
+    uint8_t      early;
+    bool         (*valid)(uint8_t * buf, uint8_t len);
+    uint8_t      (*decode)(uint8_t * buf, uint8_t len);
+    void         (*show)(uint8_t * buf, uint8_t len);
+} PROTOCOL;
+
+static const PROTOCOL protocols[] PROGMEM =
+{
+#if (CC_CONFIG == RFM69_CONFIG_CC_FSK)
+    // raw manchester, validated and decoded here
+#if defined(CC_REPAIR)
+    {RFM69_CONFIG_CC_FSK,       CC_PAYLOAD_SIZE_MANCH, CC_EARLY_CHECK_SIZE, manch_is_repairable,  cc_decode,    cc_show},
+#elif defined(CC_DEVICES)
+    {RFM69_CONFIG_CC_FSK,       CC_PAYLOAD_SIZE_MANCH, CC_EARLY_CHECK_SIZE, manch_is_valid,       cc_decode,    cc_show},
+#else
+    {RFM69_CONFIG_CC_FSK,       CC_PAYLOAD_SIZE_MANCH, CC_EARLY_CHECK_SIZE, manch_is_valid,       manch_decode, cc_show},
+#endif
+#else
+    // radio has already decoded the manchester
+    {RFM69_CONFIG_CC_FSK_MANCH, CC_PAYLOAD_SIZE,       0,                   payload_is_plausible, NULL,         cc_show},
+#endif
+#if defined(CC_SCAN)
+    {RFM69_CONFIG_OT_FSK,       0,                     0,                   NULL,                 NULL,         ot_show},
+#endif
+};
+#define NUM_PROTOCOLS (sizeof(protocols)/sizeof(protocols[0]))
+
+#if defined(CC_SCAN)
+#define PROTOCOL_BUF_SIZE RFM69_MTU
+#else
+#define PROTOCOL_BUF_SIZE CC_PAYLOAD_SIZE_MANCH
+#endif
+
+static PROTOCOL protocol = {RFM69_CONFIG_NONE, 0, 0, NULL, NULL, NULL};
+
+static void protocol_select(RFM69_CONFIG config)
+{
+    for (uint8_t i=0; i<NUM_PROTOCOLS; i++)
+    {
+        if (pgm_read_byte(&protocols[i].config) == config)
+        {
+            memcpy_P(&protocol, &protocols[i], sizeof(protocol));
+            return;
+        }
+    }
+    protocol.config = config;
+    protocol.show   = NULL; // nothing understands it, frames are dropped
+}
+
+//------------------------------------------------------------------------------
+static void reject(uint8_t * buf, uint8_t len)
+{
+    count_frame(true);
+#if defined(DEBUG)
+    ser_txromstr(STR_ERR_BAD_MANCH);
+    ser_hexbuf(buf, len);
+    end_line();
+#else
+    (void)buf;
+    (void)len;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Check and decode a frame that has been read out of the FIFO, in place.
+// returns: the decoded length, or 0 if there is nothing to show
+
+static uint8_t frame_decode(uint8_t * payload, uint8_t len)
+{
+#if defined(DEBUG)
+    if (protocol.decode != NULL)
+    {
+        ser_txromstr(STR_RAW);
+        ser_hexbuf(payload, len);
+        end_line();
+    }
+#endif
+    if (protocol.decode != NULL)
+    {
+        len = protocol.decode(payload, len);
+        if (len == 0)
+        {
+            reject(payload, 0); // partly decoded over, RAW above has it
+            return 0;
+        }
+    }
+    else if ((protocol.valid != NULL) && ! protocol.valid(payload, len))
+    {
+        reject(payload, len);
+        return 0;
+    }
+    count_frame(false);
+
+#if defined(DEBUG)
+    // dump new payload
+    ser_txromstr(STR_OK_BUF);
+    ser_hexbuf(payload, len);
+    end_line();
+#endif
+    return len;
+}
+
+#if !defined(CC_QUEUE)
+//------------------------------------------------------------------------------
+// Read a frame after PayloadReady, and pass it through the protocol
+// for the current radio config.
+
+// Read, check and decode one frame from the selected radio into 'buf'.
+// returns: the decoded length, with '*ppayload' set to the start of it,
+// or 0 if there is nothing to show
+
+static uint8_t receive_frame(uint8_t * buf, uint8_t ** ppayload)
+{
+    uint8_t * payload = buf;
+    uint8_t   len;
+
+    if (protocol.config != rfm69_getconfig())
+    {
+        protocol_select(rfm69_getconfig());
+    }
+    if (protocol.show == NULL)
+    {
+        rfm69_rx_abort();
+        return 0;
+    }
+
+    if (protocol.len == 0)
+    {   // variable length, length byte first
+        if (RFM69_RESULT_OK != rfm69_rxcbp(buf, PROTOCOL_BUF_SIZE-1))
+        {
+            rfm69_rx_abort(); // length byte was junk
+            reject(buf, 1);
+            return 0;
+        }
+        len     = buf[0];
+        payload = buf+1;
+    }
+    else
+    {
+        uint8_t early = protocol.early;
+        len = protocol.len;
+
+        // Noise often gets past the sync word, so check the start of the
+        // frame (e.g. CC type:id) before reading the rest, and drop junk
+        // straight away.
+        if (early != 0)
+        {
+            rfm69_rx(buf, early);
+            if (! protocol.valid(buf, early))
+            {
+                rfm69_rx_abort(); // listening again before anything is printed
+                reject(buf, early);
+                return 0;
+            }
+        }
+        if (RFM69_RESULT_OK != rfm69_rx(buf+early, len-early))
+        {
+            return 0;
+        }
+    }
+
+    len = frame_decode(payload, len);
+    *ppayload = payload;
+    return len;
+}
+
+//------------------------------------------------------------------------------
+#if (RFM69_RADIOS == 1)
+static void receive(void)
+{
+    uint8_t   buf[PROTOCOL_BUF_SIZE];
+    uint8_t * payload;
+    uint8_t   len = receive_frame(buf, &payload);
+
+    if (len != 0)
+    {
+        protocol.show(payload, len); // friendly CSV decode
+    }
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Diversity receive, 'first' has a frame waiting.
+// Both radios hear a frame at the same time, give or take a few bits, so
+// the other one is given a few ms to finish it too. If both get the same
+// frame it is shown once, with the other radio's copy dropped if it was
+// weaker, otherwise whatever each one got is shown. The frames are counted
+// in MSTAT once per radio.
+
+#if (RFM69_RADIOS > 1)
+static void receive_diversity(uint8_t first)
+{
+    uint8_t   buf[2][PROTOCOL_BUF_SIZE];
+    uint8_t * payload[2];
+    uint8_t   len[2];
+    uint8_t   rssi[2];
+    uint8_t   radio[2] = {first, first ^ 1};
+
+    len[0]  = receive_frame(buf[0], &payload[0]);
+    rssi[0] = rfm69_rssi();
+
+    rfm69_select(radio[1]);
+    len[1]  = 0;
+    rssi[1] = RFM69_RSSI_UNKNOWN; // not heard, only read if len[1] is set
+    for (uint8_t ms=0; ms<=CC_DIVERSITY_WAIT_MS; ms++)
+    {
+        if (RFM69_RESULT_I_READY == rfm69_receive_waiting())
+        {
+            len[1]  = receive_frame(buf[1], &payload[1]);
+            rssi[1] = rfm69_rssi();
+            break;
+        }
+        timer_delay_ms(1);
+    }
+
+    if ((len[0] != 0) && (len[0] == len[1]) && (memcmp(payload[0], payload[1], len[0]) == 0))
+    {
+        // RSSIVALUE is -dBm*2, so smaller is stronger
+        uint8_t best = (rssi[1] < rssi[0]) ? 1 : 0;
+        len[best ^ 1] = 0;
+    }
+    for (uint8_t i=0; i<2; i++)
+    {
+        if (len[i] != 0)
+        {
+            rfm69_select(radio[i]); // for the RSSI that show() adds
+            protocol.show(payload[i], len[i]);
+        }
+    }
+}
+#endif
+#endif
+
+//------------------------------------------------------------------------------
+// Receive queue, radio side.
+// Empty the radio's FIFO into the next free slot, so it can take the next
+// frame straight away. Called from loop() and after every line printed,
+// so it must not print anything itself. The early check is still done
+// here, so junk does not take up slots; it is counted for MSTAT but there
+// is no BADM line for it. A frame that passes it when every slot is full
+// is dropped and counted as an overflow.
+
+#if defined(CC_QUEUE)
+static void queue_drain(void)
+{
+    if (RFM69_RESULT_I_READY != rfm69_receive_waiting())
+    {
+        return;
+    }
+    if (protocol.config != rfm69_getconfig())
+    {
+        protocol_select(rfm69_getconfig());
+    }
+    if (protocol.show == NULL)
+    {
+        rfm69_rx_abort();
+        return;
+    }
+
+    QUEUE_SLOT * slot  = &queue[queue_in];
+    uint8_t      early = protocol.early;
+    uint8_t      spare[CC_EARLY_CHECK_SIZE]; // for the early check when full
+    uint8_t *    buf   = (queue_count < CC_QUEUE) ? slot->buf : spare;
+
+    if (early != 0)
+    {
+        rfm69_rx(buf, early);
+        if (! protocol.valid(buf, early))
+        {
+            rfm69_rx_abort();
+            stat_frames++; // MSTAT is printed from the print side
+            stat_rejects++;
+            return;
+        }
+    }
+    if (buf == spare)
+    {
+        rfm69_rx_abort();
+        stat_overflows++;
+        return;
+    }
+    if (RFM69_RESULT_OK != rfm69_rx(buf+early, protocol.len-early))
+    {
+        return;
+    }
+#if defined(RFM69_RSSI)
+    slot->rssi  = rfm69_rssi();
+#endif
+#if defined(CC_PREDICT)
+    slot->ticks = timer_ticks();
+#endif
+    queue_in = (queue_in+1 < CC_QUEUE) ? queue_in+1 : 0;
+    queue_count++;
+}
+
+//------------------------------------------------------------------------------
+// Receive queue, print side.
+// Check, decode and show the oldest frame in the ring. Its slot is only
+// given back afterwards, as the radio is drained while it is printed.
+
+static void queue_service(void)
+{
+    if (queue_count == 0)
+    {
+        if (stat_frames >= CC_STATS_EVERY)
+        {
+            show_stats(); // all junk lately, so nothing else printed it
+        }
+        return;
+    }
+
+    QUEUE_SLOT * slot = &queue[queue_out];
+#if defined(RFM69_RSSI)
+    rx_rssi  = slot->rssi;
+#endif
+#if defined(CC_PREDICT)
+    rx_ticks = slot->ticks;
+#endif
+    uint8_t len = frame_decode(slot->buf, protocol.len);
+    if (len != 0)
+    {
+        protocol.show(slot->buf, len); // friendly CSV decode
+    }
+    queue_out = (queue_out+1 < CC_QUEUE) ? queue_out+1 : 0;
+    queue_count--;
+}
+#endif
+#endif
+
+//------------------------------------------------------------------------------
+// Current Cost frame encoder, the reverse of manch_decode() and cc_show().
+// 'buf' needs CC_PAYLOAD_SIZE_MANCH bytes.
+// returns: the number of bytes to send
+
+#if defined(CC_TX)
+#if (CC_CONFIG == RFM69_CONFIG_CC_FSK)
+// each data bit becomes a pair, 1 -> 10 and 0 -> 01, so 0 -> 5, 3 -> A etc
+
+static uint8_t manch_nybble(uint8_t n)
+{
+    uint8_t out = 0;
+    for (uint8_t bit=0x08; bit!=0; bit>>=1)
+    {
+        out = (out<<2) | ((n & bit) ? 0x02 : 0x01);
+    }
+    return out;
+}
+#endif
+
+static uint8_t cc_encode(uint8_t * buf, uint8_t type, uint16_t id, uint16_t watt[3])
+{
+    // type:id id:id w1:w1 w1:w1 w2:w2 w2:w2 w3:w3 w3:w3
+    buf[0] = (type<<4) | ((id>>8) & 0x0F);
+    buf[1] = id & 0xFF;
+    for (uint8_t i=0; i<3; i++)
+    {
+        buf[2+(i*2)] = watt[i]>>8; // big-endian
+        buf[3+(i*2)] = watt[i] & 0xFF;
+    }
+#if (CC_CONFIG == RFM69_CONFIG_CC_FSK)
+    // in place, from the end, so nothing is overwritten before it is read
+    for (uint8_t i=CC_PAYLOAD_SIZE; i-- != 0;)
+    {
+        uint8_t b = buf[i];
+        buf[i*2]   = manch_nybble(b>>4);
+        buf[i*2+1] = manch_nybble(b & 0x0F);
+    }
+    return CC_PAYLOAD_SIZE_MANCH;
+#else
+    return CC_PAYLOAD_SIZE; // the radio does the manchester
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Load test transmitter, called from loop().
+// The radio adds its own preamble (AA AA AA) and the sync word (66 2D D4),
+// which is not quite what an IAM sends (00 00 66 66 66 66 2D D4), but
+// the receiver only looks for the sync word.
+// At the end of each rate a TX:gap_ms,sent,errors line is printed.
+
+static const uint16_t tx_ids[]  PROGMEM = {CC_TX_IDS};
+static const uint8_t  tx_gaps[] PROGMEM = {CC_TX_GAPS};
+#define TX_NUM_IDS  (sizeof(tx_ids)/sizeof(tx_ids[0]))
+#define TX_NUM_GAPS (sizeof(tx_gaps)/sizeof(tx_gaps[0]))
+
+static uint16_t tx_seq    = 0;
+static uint16_t tx_last   = 0; // when the last frame was sent
+static uint8_t  tx_step   = 0; // index into tx_gaps
+static uint16_t tx_sent   = 0; // at this rate
+static uint16_t tx_errors = 0; // at this rate
+
+static void tx_tick(void)
+{
+    uint8_t  gap = pgm_read_byte(&tx_gaps[tx_step]);
+    uint16_t now = timer_ticks();
+
+    if ((uint16_t)(now - tx_last) < gap)
+    {
+        return;
+    }
+    tx_last = now;
+
+    uint8_t  type = ((tx_seq % CC_TX_PAIR_EVERY) == 0) ? CC_TYPE_PAIR : CC_TYPE_METER;
+    uint16_t id   = pgm_read_word(&tx_ids[tx_seq % TX_NUM_IDS]);
+    uint16_t watt[3];
+    watt[0] = 0x8000 | (tx_seq & 0x7FFF);
+    watt[1] = 0x8000 | (gap * TIMER_TICK_MS);
+    watt[2] = 0; // not valid, so not shown
+
+    uint8_t buf[CC_PAYLOAD_SIZE_MANCH];
+    uint8_t len = cc_encode(buf, type, id, watt);
+    if (RFM69_RESULT_OK != rfm69_tx(buf, len, 1))
+    {
+        tx_errors++;
+    }
+    tx_seq++;
+
+    if (++tx_sent == CC_TX_FRAMES)
+    {
+        ser_txromstr(STR_TX);
+        ser_u16(gap * TIMER_TICK_MS);
+        ser_tx(',');
+        ser_u16(tx_sent);
+        ser_tx(',');
+        ser_u16(tx_errors);
+        ser_nl();
+        tx_sent   = 0;
+        tx_errors = 0;
+        tx_step   = (tx_step+1 < TX_NUM_GAPS) ? tx_step+1 : 0;
+    }
+}
+#endif
+
+//------------------------------------------------------------------------------
+static void loop(void)
+{
+#if defined(CC_SUPERVISOR)
+    supervise();
+#endif
+#if defined(CC_TX)
+    tx_tick();
+    return; // never receives
+#endif
+#if defined(CC_WINDOW)
+    window_check();
+#endif
+#if defined(CC_PREDICT)
+    predict_check();
+#if defined(CC_SCAN)
+    if ((scan_index != 0) && predict_window_open())
+    {
+        scan_goto(0); // scan_configs[0] is CC_CONFIG
+    }
+#endif
+#endif
+#if defined(CC_QUEUE)
+#if defined(RFM69_IRQ)
+    if (queue_count == 0)
+    {
+        wait_radio();
+    }
+#endif
+    queue_drain();
+    queue_service();
+#else
+#if defined(RFM69_IRQ)
+    wait_radio();
+#endif
+    for (uint8_t r=0; r<RFM69_RADIOS; r++)
+    {
+        radio_select(r);
+        if (RFM69_RESULT_I_READY == radio_waiting())
+        {
+#if defined(CC_PREDICT)
+            rx_ticks = timer_ticks();
+#endif
+#if defined(RFM69_STREAM)
+            receive_stream();
+#elif (RFM69_RADIOS > 1)
+            receive_diversity(r);
+#else
+            receive();
+#endif
+            break;
+        }
+    }
+#endif
+}
+
 //------------------------------------------------------------------------------
 int main(void)
 {
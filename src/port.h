@@ -1,6 +1,11 @@
 // port.h  D.J.Whale
 //
 // Mapping of port pins, and macros to access them.
+//
+// When built with the USI hardware SPI driver (SPI_USI, see build/makefile)
+// the data lines must use the fixed USI pins, DO=PB1 and DI=PB0, so the
+// radio MOSI moves to pin 6, radio MISO to pin 5 and the APP/serial pin
+// moves to pin 3. SCLK (USCK=PB2) and CS stay where they are.
 
 #ifndef _PORT_H
 #define _PORT_H
@@ -15,6 +20,37 @@
 // Note, RESET fuse is required in reset mode for low voltage programmer.
 // This also reserves the pin for later debug wire use if needed.
 
+#if defined(RFM69_IRQ)
+// RFM69 DIO0 (PayloadReady), a pin change on this wakes the CPU.
+// There is no spare pin on the 85, so by default this takes over RESET.
+// It does not work until the RSTDISBL fuse is programmed, with
+// 'make set-fuses-noreset' (build/makefile) after 'make program'. That
+// also turns off ISP, so from then on only a high voltage programmer can
+// re-flash the chip. It can be moved to any PBn that is free on your board.
+#define RADIO_IRQ            5
+#define RADIO_IRQ_MASK       (1<<RADIO_IRQ)
+#define RADIO_IRQ_AS_IN()    DDRB &= ~ RADIO_IRQ_MASK
+#define RADIO_IRQ_IS_LOW()   ((PINB & RADIO_IRQ_MASK) == 0x00)
+#define RADIO_IRQ_IS_HIGH()  ((PINB & RADIO_IRQ_MASK) != 0x00)
+#define RADIO_IRQ_ENABLE()   do { PCMSK |= RADIO_IRQ_MASK; GIMSK |= (1<<PCIE);} while (0)
+#endif
+
+#if defined(RFM69_RADIOS) && (RFM69_RADIOS > 1)
+// CS of the second radio (active low), sharing MOSI/MISO/SCLK with the
+// first. Like RADIO_IRQ this takes over RESET, and does not work until
+// 'make set-fuses-noreset' has programmed RSTDISBL, which turns off ISP.
+#if defined(RFM69_IRQ)
+#error "RADIO_IRQ and SPI_CS2 both want pin 1, move one of them"
+#endif
+#if (RFM69_RADIOS > 2)
+#error "there are only pins for two radios"
+#endif
+#define SPI_CS2          5
+#define SPI_CS2_MASK     (1<<SPI_CS2)
+#define SPI_CS2_AS_OUT() DDRB  |=   SPI_CS2_MASK
+#define SPI_CS2_AS_IN()  DDRB  &= ~ SPI_CS2_MASK
+#endif
+
 
 //----- PIN 2 -----------------------------------------------------------------
 //PB3 pin 2  CS (active low)    85: (PB3/PCINT3/XTAL1/CLKI/nOC1B/ADC3)
@@ -35,8 +71,13 @@
 // PB4 pin 3 MISO               85: (PB4/PCINT4/XTAL2/CLKO/OC1B/ADC2)
 //
 // This is a software SPI port
+// (APP pin when SPI_USI, MISO is then on pin 5)
 
+#if defined(SPI_USI)
+#define SPI_MISO           0
+#else
 #define SPI_MISO           4
+#endif
 #define SPI_MISO_MASK      (1<<SPI_MISO)
 #define SPI_MISO_AS_IN()   DDRB &= ~ SPI_MISO_MASK
 #define SPI_MISO_IS_LOW()  ((PINB & SPI_MISO_MASK) == 0x00)
@@ -55,8 +96,13 @@
 //PB0 pin 5 MOSI                85: (PB0/MOSI/DI/SDA/AIN0/OC0A/nOC1A/AREF/PCINT0)
 //
 // This is a software SPI port
+// (MISO when SPI_USI, USI DI is fixed to this pin)
 
+#if defined(SPI_USI)
+#define SPI_MOSI           1
+#else
 #define SPI_MOSI           0
+#endif
 #define SPI_MOSI_MASK      (1<<SPI_MOSI)
 #define SPI_MOSI_AS_IN()   DDRB &= ~ SPI_MOSI_MASK
 #define SPI_MOSI_IS_LOW()  ((PINB & SPI_MOSI_MASK) == 0x00)
@@ -70,8 +116,13 @@
 
 //----- PIN 6 -----------------------------------------------------------------
 //PB1 pin 6  APP PIN            85:(PB1/MISO/D0/AIN1/OC0B/OC1A/PCINT1)
+// (MOSI when SPI_USI, USI DO is fixed to this pin, APP is then on pin 3)
 
+#if defined(SPI_USI)
+#define APP            4
+#else
 #define APP            1
+#endif
 #define APP_MASK       (1<<APP)
 #define APP_AS_IN()    DDRB &= ~ APP_MASK
 #define APP_IS_LOW()   ((PINB & APP_MASK) == 0)
@@ -109,7 +160,7 @@
 //----- PIN 7 -----------------------------------------------------------------
 //PB2 pin 7 SCLK                85: (PB2/SCK/USCK/SCL/ADC1/T0/INT0/PCINT2)
 
-// This is a software SPI port
+// This is a software SPI port (USCK when SPI_USI)
 
 #define SPI_SCLK           2
 #define SPI_SCLK_MASK      (1<<SPI_SCLK)
@@ -8,9 +8,57 @@
 #include "rfm69.h"
 #include "spi.h"
 #include "ser.h"
+#include "port.h"
+#include "timer.h"
+
+#if defined(RFM69_IRQ)
+#include <avr/interrupt.h>
+#endif
 
 // CONFIG
 #define DEFAULT_TIMES 2
+#define CONFIG_VERIFY 1  // read registers back after rfm69_setconfig()
+#define STREAM_TIMEOUT_MS 10 // a 2 byte chunk takes 4ms on air at 4096bps
+#define MODE_TIMEOUT_MS 10   // mode changes take well under 1ms
+#define TX_TIMEOUT_MS   250  // a full 66 byte FIFO takes 129ms on air at 4096bps
+#define FEI_RETUNE      49   // retune when the estimate is this far out (49*61Hz = 3kHz)
+#define FEI_RANGE       328  // never move more than this from the config (20kHz)
+#define FEI_MIN_SAMPLES 4    // good packets needed before the first retune
+#define FEI_MAX         512  // readings further out than RXBW are junk (31kHz)
+
+#define NOISE_EVERY     64   // idle receive polls between noise floor samples
+#define NOISE_MARGIN    6    // RSSITHRESH sits this far above the floor (3dB)
+#define NOISE_HYST      4    // and is only rewritten if it moves this much (2dB)
+#define NOISE_THRESH_MIN 0xB4 // never demand more than -90dBm
+#define NOISE_THRESH_MAX 0xE4 // never go below the chip default, -114dBm
+
+#define LISTEN_COEF_IDLE 1   // asleep for 1 x 4.1ms
+#define LISTEN_COEF_RX   40  // then listening for 40 x 64us = 2.56ms
+#define LISTEN_TIMEOUT   20  // no payload 20x16 bits after RSSI, back to sleep (78ms)
+
+#if defined(RFM69_NOISE) && defined(RFM69_IRQ)
+#error "RFM69_NOISE samples between packets, while RFM69_IRQ has the CPU asleep"
+#endif
+
+#if defined(RFM69_LISTEN) && !defined(RFM69_IRQ)
+#error "RFM69_LISTEN needs RFM69_IRQ, DIO0 is what wakes the CPU"
+#endif
+
+#if defined(RFM69_LISTEN) && defined(RFM69_STREAM)
+#error "RFM69_LISTEN ends each receive at PayloadReady, it cannot stream"
+#endif
+
+#if defined(RFM69_FEI) && defined(RFM69_IRQ) && !defined(RFM69_STREAM)
+#error "RFM69_FEI needs to see sync, which RFM69_IRQ sleeps through, add RFM69_STREAM"
+#endif
+
+// receive_waiting() polls DIO0 for PayloadReady, or else reads the flags
+// over SPI, and then also watches for sync, to catch things mid packet
+#if defined(RFM69_IRQ) && !defined(RFM69_STREAM) && !defined(RFM69_LISTEN)
+#define PAYLOAD_ON_DIO0 1
+#elif defined(RFM69_RSSI) || defined(RFM69_FEI) || defined(RFM69_NOISE)
+#define WATCH_SYNC 1
+#endif
 
 
 //===== PRIVATE ================================================================
@@ -23,10 +71,23 @@ typedef struct
     RFM69_MODE current_mode;
     RFM69_CONFIG config;
     uint8_t radiover;
+#if defined(RFM69_RSSI)
+    uint8_t rssi;          // RSSIVALUE of the current/last packet
+    bool    rssi_sampled;  // already taken for the packet in progress
+#endif
+#if defined(RFM69_FEI)
+    uint8_t fei_state;     // FEI_IDLE etc, see _fei_start()
+    uint8_t fei_samples;   // good packets since the last retune
+    int16_t fei_est8;      // running frequency error estimate, Fstep*8
+    int16_t fei_offset;    // carrier moved this far from the config, Fstep
+#endif
+#if defined(RFM69_NOISE)
+    uint8_t  noise_polls;  // idle polls since the last sample
+    uint16_t noise8;       // noise floor estimate, RSSIVALUE*8
+    uint8_t  noise_thresh; // what RSSITHRESH was last set to
+#endif
 } RFM69_DATA;
 
-static RFM69_DATA _rfm69_data = {RFM69_MODE_STBY, RFM69_CONFIG_NONE, 0};
-
 
 typedef struct
 {
@@ -167,11 +228,73 @@ typedef struct
 #define HRF_MASK_PACKETMODE            0x60
 #define HRF_MASK_MODULATION            0x18
 #define HRF_MASK_PAYLOADRDY            0x04
+#define HRF_MASK_LNA_CURRENTGAIN       0x38     // read only bits in LNA
+#define HRF_MASK_SYNCADDRESSMATCH      0x01
+#define HRF_MASK_TXSTART_NOTEMPTY      0x80     // FIFOTHRESH TxStartCondition
+#define HRF_MASK_FEIDONE               0x40     // AFCFEI
+#define HRF_MASK_ADDRESSFILTERING      0x06     // PACKETCONFIG1
+#define HRF_MASK_FEISTART              0x20     // AFCFEI
+#define HRF_MASK_LISTENON              0x40     // OPMODE
+#define HRF_MASK_LISTENABORT           0x20     // OPMODE, with LISTENON clear
 
 // Radio modes
 #define HRF_MODE_STANDBY               0x04     // Standby
 #define HRF_MODE_TRANSMITTER           0x0C     // Transmiter
 #define HRF_MODE_RECEIVER              0x10     // Receiver
+#define HRF_MODE_LISTEN                (HRF_MODE_STANDBY|HRF_MASK_LISTENON)
+
+// Prevent HRF_MODE leaking via API
+static const uint8_t _hrf_modes[] =
+{
+    /* RFM69_MODE_STBY */ HRF_MODE_STANDBY,
+    /* RFM69_MODE_RX   */ HRF_MODE_RECEIVER,
+    /* RFM69_MODE_TX   */ HRF_MODE_TRANSMITTER,
+#if defined(RFM69_LISTEN)
+    /* RFM69_MODE_LISTEN */ HRF_MODE_LISTEN
+#endif
+};
+
+
+// Shadow copy of the writable registers OPMODE..FIFOTHRESH, so that
+// writes that would not change anything never reach the SPI bus.
+// 'known' marks values that match the radio, 'dirty' marks values staged
+// by _shadow_set() that _shadow_flush() has not written out yet.
+// Registers with strobe or read-only bits (AFCFEI, RSSICONFIG, IRQFLAGS,
+// PACKETCONFIG2 RestartRx) must always go through _writereg() instead.
+
+#define SHADOW_FIRST      HRF_ADDR_OPMODE
+#define SHADOW_LAST       HRF_ADDR_FIFOTHRESH
+#define SHADOW_SIZE       (SHADOW_LAST - SHADOW_FIRST + 1)
+#define SHADOW_FLAG_BYTES ((SHADOW_SIZE+7)/8)
+
+typedef struct
+{
+    uint8_t value[SHADOW_SIZE];
+    uint8_t known[SHADOW_FLAG_BYTES];
+    uint8_t dirty[SHADOW_FLAG_BYTES];
+} RFM69_SHADOW;
+
+
+// With more than one radio each has its own state and shadow, and
+// rfm69_select() picks the one that all the other calls work on. The
+// names below then refer to the selected one, so the rest of the driver
+// is the same either way.
+
+#if (RFM69_RADIOS > 1)
+typedef struct
+{
+    RFM69_DATA   data;
+    RFM69_SHADOW shadow;
+} RFM69_INSTANCE;
+
+static RFM69_INSTANCE   _radios[RFM69_RADIOS];
+static RFM69_INSTANCE * _radio = &_radios[0];
+#define _rfm69_data (_radio->data)
+#define _shadow     (_radio->shadow)
+#else
+static RFM69_DATA   _rfm69_data = {RFM69_MODE_STBY, RFM69_CONFIG_NONE, 0};
+static RFM69_SHADOW _shadow;
+#endif
 
 // Values to store in registers
 #define HRF_VAL_DATAMODUL_FSK          0x00     // Modulation scheme FSK
@@ -204,6 +327,19 @@ typedef struct
 #define HRF_VAL_PAYLOADLEN66           66       // max Length in RX, not used in Tx
 #define HRF_VAL_FIFOTHRESH1            0x81     // Condition to start packet transmission: at least one byte in FIFO
 #define HRF_VAL_FIFOTHRESH30           0x1E     // Condition to start packet transmission: wait for 30 bytes in FIFO
+#define HRF_VAL_DIOMAPPING1_PAYLOADRDY 0x40     // DIO0 01 -> PayloadReady in RX
+#define HRF_VAL_DIOMAPPING1_SYNCADDR   0x80     // DIO0 10 -> SyncAddress in RX
+#define HRF_VAL_PACKETCONFIG2_RESTART  0x06     // RestartRx, keep AutoRxRestartOn
+#define HRF_VAL_ADDRESSFILTERING_BOTH  0x04     // NodeAddress or BroadcastAddress
+#define HRF_VAL_LISTEN1_RSSI           0x94     // idle in 4.1ms, rx in 64us, wake on RSSI, ListenEnd=10 resume after packet
+
+// DIO0 tells the app when there is something to read: the end of the
+// packet normally, or the start of it when streaming.
+#if defined(RFM69_STREAM)
+#define DIO0_MAPPING                   HRF_VAL_DIOMAPPING1_SYNCADDR
+#else
+#define DIO0_MAPPING                   HRF_VAL_DIOMAPPING1_PAYLOADRDY
+#endif
 
 
 //===== RADIO CONFIGS ==========================================================
@@ -220,52 +356,107 @@ typedef struct
 #define RADIO_VAL_CC_SYNCVALUE3             0xD4
 
 #define RADIO_VAL_CC_PACKETCONFIG1          0x00            // Fixed length, no Manchester, no addr
-//#define RADIO_VAL_CC_PACKETCONFIG1          0x20            // 0010 0000 Fixed length, Manchester decoding, no addr
+#define RADIO_VAL_CC_PACKETCONFIG1_MANCH    0x20            // 0010 0000 Fixed length, Manchester decoding, no addr
 #define RADIO_VAL_CC_FRMSB                  0x6C            // 433.91mHz
 #define RADIO_VAL_CC_FRMID                  0x7A
 #define RADIO_VAL_CC_FRLSB                  0x3D
 
-static const RFM69_CONFIG_REC _config_CC_FSK[] = {
-    // RFM69HCW (high power)
-    {HRF_ADDR_PALEVEL,        0x7F},                        // RFM69HCW high power PA_BOOST PA1+PA2
-    {HRF_ADDR_OCP,            0x00},                        // RFM69HCW over current protect off
-    // RFM69 (low power)
-    //{HRF_ADDR_PALEVEL,        0x9F},                      // RMF69 (Energenie RT board) 13dBm, PA0=ON
+// Kept in register address order, so that each run of consecutive registers
+// can be written and read back as a single burst transaction.
+// The modem settings are shared, the packet format is per config (below).
 
+static const RFM69_CONFIG_REC _config_CC_FSK[] = {
     // FSK specific
     {HRF_ADDR_DATAMODUL,        HRF_VAL_DATAMODUL_FSK},     // FSK + packet mode
     //{HRF_ADDR_DATAMODUL,          0x40},                    // FSK + continuous, with bit sync (10)
-    {HRF_ADDR_AFCCTRL,            HRF_VAL_AFCCTRLS},        // standard AFC routine
-    {HRF_ADDR_LNA,                HRF_VAL_LNA50},           // 200ohms, gain by AGC loop -> 50ohms
-    //{HRF_ADDR_RSSITHRESH,       0xF0},                    // 120*2
+    {HRF_ADDR_BITRATEMSB,         0x1E},                    // 32MHz/4096 = 7813 = 1E85
+    {HRF_ADDR_BITRATELSB,         0x85},                    //
     {HRF_ADDR_FDEVMSB,            HRF_VAL_FDEVMSB30},       // frequency deviation 5kHz 0x0052 -> 30kHz 0x01EC
     {HRF_ADDR_FDEVLSB,            HRF_VAL_FDEVLSB30},       // frequency deviation 5kHz 0x0052 -> 30kHz 0x01EC
     {HRF_ADDR_FRMSB,              RADIO_VAL_CC_FRMSB},      // carrier freq -> 433.91MHz
     {HRF_ADDR_FRMID,              RADIO_VAL_CC_FRMID},      // carrier freq
     {HRF_ADDR_FRLSB,              RADIO_VAL_CC_FRLSB},      // carrier freq
+    {HRF_ADDR_AFCCTRL,            HRF_VAL_AFCCTRLS},        // standard AFC routine
+
+    // RFM69HCW (high power)
+    {HRF_ADDR_PALEVEL,        0x7F},                        // RFM69HCW high power PA_BOOST PA1+PA2
+    {HRF_ADDR_OCP,            0x00},                        // RFM69HCW over current protect off
+    // RFM69 (low power)
+    //{HRF_ADDR_PALEVEL,        0x9F},                      // RMF69 (Energenie RT board) 13dBm, PA0=ON
+
+    {HRF_ADDR_LNA,                HRF_VAL_LNA50},           // 200ohms, gain by AGC loop -> 50ohms
     {HRF_ADDR_RXBW,               HRF_VAL_RXBW60},          // channel filter bandwidth 10kHz -> 60kHz  page:26
-    {HRF_ADDR_BITRATEMSB,         0x1E},                    // 32MHz/4096 = 7813 = 1E85
-    {HRF_ADDR_BITRATELSB,         0x85},                    //
+    //{HRF_ADDR_RSSITHRESH,       0xF0},                    // 120*2
     {HRF_ADDR_SYNCCONFIG,         HRF_VAL_SYNCCONFIG3},     // 3 bytes of sync word
     {HRF_ADDR_SYNCVALUE1,         RADIO_VAL_CC_SYNCVALUE1}, // 1st byte of Sync word
     {HRF_ADDR_SYNCVALUE2,         RADIO_VAL_CC_SYNCVALUE2}, // 2nd byte of Sync word
-    {HRF_ADDR_SYNCVALUE3,         RADIO_VAL_CC_SYNCVALUE3}, // 3rd byte of Sync word
-    {HRF_ADDR_PACKETCONFIG1,      RADIO_VAL_CC_PACKETCONFIG1},
+    {HRF_ADDR_SYNCVALUE3,         RADIO_VAL_CC_SYNCVALUE3}  // 3rd byte of Sync word
+};
+#define CONFIG_CC_FSK_COUNT (sizeof(_config_CC_FSK)/sizeof(RFM69_CONFIG_REC))
 
+// Raw manchester bits, decoded and validated in software
+static const RFM69_CONFIG_REC _packet_CC_RAW[] = {
+    {HRF_ADDR_PACKETCONFIG1,      RADIO_VAL_CC_PACKETCONFIG1},
     {HRF_ADDR_PAYLOADLEN,         16}                         // Fixed number of receive bytes (manchester encoded doubles it)
-//    {HRF_ADDR_NODEADRS,           0x06},                    // Node address used in address filtering (not used)
+//    {HRF_ADDR_NODEADRS,           0x06},                    // Node address used in address filtering (see rfm69_setaddress)
 };
-#define CONFIG_CC_FSK_COUNT (sizeof(_config_CC_FSK)/sizeof(RFM69_CONFIG_REC))
+#define PACKET_CC_RAW_COUNT (sizeof(_packet_CC_RAW)/sizeof(RFM69_CONFIG_REC))
+
+// Manchester decoded by the radio, half the FIFO bytes, but there is no
+// way to see symbol errors, the radio just picks a bit for each pair.
+static const RFM69_CONFIG_REC _packet_CC_MANCH[] = {
+    {HRF_ADDR_PACKETCONFIG1,      RADIO_VAL_CC_PACKETCONFIG1_MANCH},
+    {HRF_ADDR_PAYLOADLEN,         8}                          // Fixed number of decoded bytes
+};
+#define PACKET_CC_MANCH_COUNT (sizeof(_packet_CC_MANCH)/sizeof(RFM69_CONFIG_REC))
+
+//----- OPENTHINGS FSK (Energenie MiHome) -------------------------------------
+// 4800bps FSK at 434.3MHz, sync 2D D4, variable length with the radio
+// doing the manchester decoding. The first byte is the length.
+
+#define RADIO_VAL_OT_SYNCVALUE1             0x2D
+#define RADIO_VAL_OT_SYNCVALUE2             0xD4
+#define RADIO_VAL_OT_PACKETCONFIG1          0xA0            // Variable length, Manchester coding, no addr
+
+static const RFM69_CONFIG_REC _config_OT_FSK[] = {
+    {HRF_ADDR_DATAMODUL,          HRF_VAL_DATAMODUL_FSK},   // FSK + packet mode
+    {HRF_ADDR_BITRATEMSB,         0x1A},                    // 32MHz/4800 = 6667 = 1A0B
+    {HRF_ADDR_BITRATELSB,         0x0B},                    //
+    {HRF_ADDR_FDEVMSB,            HRF_VAL_FDEVMSB30},       // frequency deviation 30kHz
+    {HRF_ADDR_FDEVLSB,            HRF_VAL_FDEVLSB30},       //
+    {HRF_ADDR_FRMSB,              HRF_VAL_FRMSB434},        // carrier freq -> 434.3MHz
+    {HRF_ADDR_FRMID,              HRF_VAL_FRMID434},        //
+    {HRF_ADDR_FRLSB,              HRF_VAL_FRLSB434},        //
+    {HRF_ADDR_AFCCTRL,            HRF_VAL_AFCCTRLS},        // standard AFC routine
+    {HRF_ADDR_PALEVEL,            0x7F},                    // RFM69HCW high power PA_BOOST PA1+PA2
+    {HRF_ADDR_OCP,                0x00},                    // RFM69HCW over current protect off
+    {HRF_ADDR_LNA,                HRF_VAL_LNA50},           // 200ohms, gain by AGC loop -> 50ohms
+    {HRF_ADDR_RXBW,               HRF_VAL_RXBW60},          // channel filter bandwidth 60kHz
+    {HRF_ADDR_SYNCCONFIG,         HRF_VAL_SYNCCONFIG2},     // 2 bytes of sync word
+    {HRF_ADDR_SYNCVALUE1,         RADIO_VAL_OT_SYNCVALUE1}, // 1st byte of Sync word
+    {HRF_ADDR_SYNCVALUE2,         RADIO_VAL_OT_SYNCVALUE2}  // 2nd byte of Sync word
+};
+#define CONFIG_OT_FSK_COUNT (sizeof(_config_OT_FSK)/sizeof(RFM69_CONFIG_REC))
+
+static const RFM69_CONFIG_REC _packet_OT[] = {
+    {HRF_ADDR_PACKETCONFIG1,      RADIO_VAL_OT_PACKETCONFIG1},
+    {HRF_ADDR_PAYLOADLEN,         HRF_VAL_PAYLOADLEN66}       // max length in RX
+};
+#define PACKET_OT_COUNT (sizeof(_packet_OT)/sizeof(RFM69_CONFIG_REC))
 
 static const struct
 {
     RFM69_CONFIG_REC const * config;
     uint8_t                count;
+    RFM69_CONFIG_REC const * packet;
+    uint8_t                packet_count;
 } _configs[] =
 {
-    /* RFM69_CONFIG_CC_FSK  */ {_config_CC_FSK,  CONFIG_CC_FSK_COUNT}
+    /* RFM69_CONFIG_CC_FSK       */ {_config_CC_FSK,  CONFIG_CC_FSK_COUNT, _packet_CC_RAW,   PACKET_CC_RAW_COUNT},
+    /* RFM69_CONFIG_CC_FSK_MANCH */ {_config_CC_FSK,  CONFIG_CC_FSK_COUNT, _packet_CC_MANCH, PACKET_CC_MANCH_COUNT},
+    /* RFM69_CONFIG_OT_FSK       */ {_config_OT_FSK,  CONFIG_OT_FSK_COUNT, _packet_OT,       PACKET_OT_COUNT}
 };
-#define NUM_CONFIGS (sizeof(_configs)/sizeof(RFM69_CONFIG_REC *))
+#define NUM_CONFIGS (sizeof(_configs)/sizeof(_configs[0]))
 
 
 //------------------------------------------------------------------------------
@@ -297,13 +488,29 @@ static bool _checkreg(uint8_t addr, uint8_t mask, uint8_t value)
 
 
 //------------------------------------------------------------------------------
-static void _waitreg(uint8_t addr, uint8_t mask, uint8_t value)
+// Wait for a register to match, giving up after 'ms' milliseconds, so that
+// a radio that has gone away cannot lock the receiver up for good.
+// The 8 bit timer wraps every 256us, so this relies on each register read
+// taking less than that, which it does even with the software SPI.
+// returns: true if the register matched, false on timeout.
+
+static bool _waitreg(uint8_t addr, uint8_t mask, uint8_t value, uint16_t ms)
 {
+    uint8_t  t  = timer_read();
+    uint16_t us = 0;
+
     while (! _checkreg(addr, mask, value))
     {
-      // busy wait
-      //TODO: No timeout or error recovery? Can cause permanent lockup
+        uint8_t now = timer_read();
+        us += timer_diff(t, now);
+        t   = now;
+        if (us >= 1000)
+        {
+            us -= 1000;
+            if (ms-- == 0) {return false;}
+        }
     }
+    return true;
 }
 
 
@@ -318,14 +525,24 @@ static void _writereg(uint8_t addr, uint8_t data)
 
 
 //------------------------------------------------------------------------------
+// Writing 1 to FifoOverrun clears the flags and the whole FIFO in one go,
+// so this takes one transaction however full the FIFO is, and cannot lock
+// up on a radio that keeps reporting FifoNotEmpty.
+
 void _clear_fifo(void)
 {
-    //TODO: max fifolen is 66, should bail after that to prevent lockup
-    //especially if radio crashed and SPI always returns stuck flag bit
-    while ((_readreg(HRF_ADDR_IRQFLAGS2) & HRF_MASK_FIFONOTEMPTY) == HRF_MASK_FIFONOTEMPTY)
-    {
-        _readreg(HRF_ADDR_FIFO);
-    }
+    _writereg(HRF_ADDR_IRQFLAGS2, HRF_MASK_FIFOOVERRUN);
+}
+
+
+//------------------------------------------------------------------------------
+// Abandon the packet in progress and go back to waiting for a sync word.
+// Restart first, so that the FIFO stops filling while it is cleared.
+
+static void _restart_rx(void)
+{
+    _writereg(HRF_ADDR_PACKETCONFIG2, HRF_VAL_PACKETCONFIG2_RESTART);
+    _clear_fifo();
 }
 
 
@@ -340,42 +557,460 @@ static void _writefifo_burst(uint8_t* buf, uint8_t len)
 
 
 //------------------------------------------------------------------------------
-static void _wait_ready(void)
+static bool _wait_ready(void)
 {
-    _waitreg(HRF_ADDR_IRQFLAGS1, HRF_MASK_MODEREADY, HRF_MASK_MODEREADY);
+    return _waitreg(HRF_ADDR_IRQFLAGS1, HRF_MASK_MODEREADY, HRF_MASK_MODEREADY, MODE_TIMEOUT_MS);
 }
 
 
 //------------------------------------------------------------------------------
-static void _wait_tx_ready(void)
+static bool _wait_tx_ready(void)
 {
-    _waitreg(HRF_ADDR_IRQFLAGS1, HRF_MASK_MODEREADY|HRF_MASK_TXREADY, HRF_MASK_MODEREADY|HRF_MASK_TXREADY);
+    return _waitreg(HRF_ADDR_IRQFLAGS1, HRF_MASK_MODEREADY|HRF_MASK_TXREADY, HRF_MASK_MODEREADY|HRF_MASK_TXREADY, MODE_TIMEOUT_MS);
 }
 
 
 //------------------------------------------------------------------------------
+// Shadow flag helpers, 'i' is the shadow index (addr - SHADOW_FIRST)
+
+#define _FLAG_BYTE(I) ((I)>>3)
+#define _FLAG_BIT(I)  (1<<((I)&0x07))
+
+static bool _flag_get(uint8_t * flags, uint8_t i)
+{
+    return (flags[_FLAG_BYTE(i)] & _FLAG_BIT(i)) != 0;
+}
+
+static void _flag_set(uint8_t * flags, uint8_t i)
+{
+    flags[_FLAG_BYTE(i)] |= _FLAG_BIT(i);
+}
+
+static void _flag_clr(uint8_t * flags, uint8_t i)
+{
+    flags[_FLAG_BYTE(i)] &= ~_FLAG_BIT(i);
+}
+
+
+//------------------------------------------------------------------------------
+// Forget everything, the radio state is unknown (e.g. after power up).
+
+static void _shadow_forget(void)
+{
+    for (uint8_t i=0; i<SHADOW_FLAG_BYTES; i++)
+    {
+        _shadow.known[i] = 0;
+        _shadow.dirty[i] = 0;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Record a value that is known to be in the radio (e.g. from a read back).
+
+static void _shadow_learn(uint8_t addr, uint8_t value)
+{
+    uint8_t i = addr - SHADOW_FIRST;
+    _shadow.value[i] = value;
+    _flag_set(_shadow.known, i);
+}
+
+
+//------------------------------------------------------------------------------
+// Stage a register write. Nothing is sent until _shadow_flush().
+// returns: true if the register will change.
+
+static bool _shadow_set(uint8_t addr, uint8_t value)
+{
+    uint8_t i = addr - SHADOW_FIRST;
+
+    if (_flag_get(_shadow.known, i) && (_shadow.value[i] == value))
+    {
+        _flag_clr(_shadow.dirty, i); // back to what the radio already has
+        return false;
+    }
+    _shadow.value[i] = value;
+    _flag_set(_shadow.dirty, i);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Write out all staged registers.
+// The radio auto-increments the address in burst mode, so each run of
+// consecutive dirty registers goes out as one transaction.
+
+static void _shadow_flush(void)
+{
+    uint8_t i = 0;
+
+    while (i < SHADOW_SIZE)
+    {
+        if (! _flag_get(_shadow.dirty, i))
+        {
+            i++;
+            continue;
+        }
+
+        spi_select();
+        spi_byte((i + SHADOW_FIRST) | HRF_MASK_WRITE_DATA);
+        do
+        {
+            spi_byte(_shadow.value[i]);
+            _flag_clr(_shadow.dirty, i);
+            _flag_set(_shadow.known, i);
+            i++;
+        }
+        while ((i < SHADOW_SIZE) && _flag_get(_shadow.dirty, i));
+        spi_deselect();
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Write a single register via the shadow.
+// returns: true if it was written, false if the radio already had 'value'.
+
+static bool _writereg_cached(uint8_t addr, uint8_t value)
+{
+    if (! _shadow_set(addr, value))
+    {
+        return false;
+    }
+    _writereg(addr, value);
+    _flag_clr(_shadow.dirty, addr - SHADOW_FIRST);
+    _flag_set(_shadow.known, addr - SHADOW_FIRST);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Stage a config table, _shadow_flush() then writes it out.
+// Registers that already hold the right value are skipped, the rest go out
+// in bursts (tables are kept in address order so the runs stay long).
+
 static void _config(RFM69_CONFIG_REC const * p_config, uint8_t len)
 {
     while (len-- != 0)
     {
-        _writereg(p_config->addr, p_config->value);
+        _shadow_set(p_config->addr, p_config->value);
         p_config++;
     }
 }
 
 
+//------------------------------------------------------------------------------
+// Bits that are not part of a config: read only status, and settings
+// such as address filtering that the app layers on top of one.
+
+static uint8_t _config_mask(uint8_t addr)
+{
+    switch (addr)
+    {
+        case HRF_ADDR_LNA:           return (uint8_t)~HRF_MASK_LNA_CURRENTGAIN;
+        case HRF_ADDR_PACKETCONFIG1: return (uint8_t)~HRF_MASK_ADDRESSFILTERING;
+        default:                     return 0xFF;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Read a config table back from the radio, one burst per address run.
+// Matching registers are recorded in the shadow.
+// returns: true if every register holds the value in the table.
+
+static bool _config_check(RFM69_CONFIG_REC const * p_config, uint8_t len)
+{
+    bool same = true;
+
+    while (len != 0)
+    {
+        uint8_t addr = p_config->addr;
+
+        spi_select();
+        spi_byte(addr);
+        do
+        {
+            uint8_t value = spi_byte(0x00);
+            if (((value ^ p_config->value) & _config_mask(addr)) != 0)
+            {
+                same = false;
+            }
+            else
+            {
+                _shadow_learn(addr, value);
+            }
+            p_config++;
+            addr++;
+        }
+        while ((--len != 0) && (p_config->addr == addr));
+        spi_deselect();
+    }
+    return same;
+}
+
+
+//------------------------------------------------------------------------------
+// The pin change only has to wake the CPU from sleep, the DIO0 level itself
+// is read by rfm69_receive_waiting(), so there is nothing to do in here.
+
+#if defined(RFM69_IRQ)
+EMPTY_INTERRUPT(PCINT0_vect);
+#endif
+
+
+//------------------------------------------------------------------------------
+// RSSI is only meaningful while the packet is being received, once the FIFO
+// is emptied the receiver restarts and it goes back to the noise floor.
+// _rssi_sample() takes it once per packet, as early as possible.
+// _rssi_take() makes sure there is one, and re-arms for the next packet.
+
+#if defined(RFM69_RSSI)
+static void _rssi_sample(void)
+{
+    if (! _rfm69_data.rssi_sampled)
+    {
+        _rfm69_data.rssi         = _readreg(HRF_ADDR_RSSIVALUE);
+        _rfm69_data.rssi_sampled = true;
+    }
+}
+
+#if defined(PAYLOAD_ON_DIO0) || defined(RFM69_STREAM)
+static void _rssi_take(void)
+{
+    _rssi_sample();
+    _rfm69_data.rssi_sampled = false;
+}
+#endif
+
+#if defined(WATCH_SYNC)
+// At PayloadReady, when sync is watched for. If it was not seen while the
+// packet was arriving (the app was busy), RSSIVALUE is now the noise after
+// it, so there is no reading for this packet.
+static void _rssi_done(void)
+{
+    if (! _rfm69_data.rssi_sampled)
+    {
+        _rfm69_data.rssi = RFM69_RSSI_UNKNOWN;
+    }
+    _rfm69_data.rssi_sampled = false;
+}
+#endif
+#endif
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+// Frequency error tracking.
+// FEI needs a carrier to measure, so it is started at sync, while the rest
+// of the packet is still on air, and only read back if the app says the
+// packet was good (a sync on noise gives a meaningless FEI).
+//   FEI_STARTED: measuring, the packet is still arriving
+//   FEI_PACKET:  the packet has been handed to the app, FEI belongs to it
+
+#if defined(RFM69_FEI)
+#define FEI_IDLE    0
+#define FEI_STARTED 1
+#define FEI_PACKET  2
+
+static void _fei_start(void)
+{
+    if (_rfm69_data.fei_state != FEI_STARTED)
+    {
+        _writereg(HRF_ADDR_AFCFEI, HRF_MASK_FEISTART);
+        _rfm69_data.fei_state = FEI_STARTED;
+    }
+}
+
+static void _fei_packet(void)
+{
+    if (_rfm69_data.fei_state == FEI_STARTED)
+    {
+        _rfm69_data.fei_state = FEI_PACKET;
+    }
+}
+
+static void _fei_reset(void)
+{
+    _rfm69_data.fei_state   = FEI_IDLE;
+    _rfm69_data.fei_samples = 0;
+    _rfm69_data.fei_est8    = 0;
+    _rfm69_data.fei_offset  = 0;
+}
+
+// Move the carrier by 'steps' Fsteps. FRLSB goes last in the burst and is
+// what makes the synthesiser take the new value, RestartRx then relocks.
+
+static void _fei_retune(int16_t steps)
+{
+    uint32_t frf = ((uint32_t)_shadow.value[HRF_ADDR_FRMSB - SHADOW_FIRST] << 16)
+                 | ((uint16_t)_shadow.value[HRF_ADDR_FRMID - SHADOW_FIRST] << 8)
+                 | _shadow.value[HRF_ADDR_FRLSB - SHADOW_FIRST];
+    frf += steps;
+
+    _shadow_set(HRF_ADDR_FRMSB, (uint8_t)(frf >> 16));
+    _shadow_set(HRF_ADDR_FRMID, (uint8_t)(frf >> 8));
+    _shadow_set(HRF_ADDR_FRLSB, (uint8_t)frf);
+    _shadow_flush();
+    _restart_rx();
+}
+#endif
+
+
+//------------------------------------------------------------------------------
+// Noise floor tracking.
+// Called on receive polls that found nothing, i.e. no sync and no payload,
+// so RSSIVALUE is (mostly) background noise. The floor follows weaker
+// readings quickly and stronger ones slowly, so an odd packet preamble
+// or a burst of interference does not drag it up. RSSITHRESH is then kept
+// NOISE_MARGIN above it, so the radio stops starting on noise but still
+// hears anything that could actually be decoded.
+// RSSI values are -dBm*2, so 'stronger' is numerically smaller.
+
+#if defined(RFM69_NOISE)
+static void _noise_sample(void)
+{
+    if (++_rfm69_data.noise_polls < NOISE_EVERY)
+    {
+        return;
+    }
+    _rfm69_data.noise_polls = 0;
+
+    uint16_t floor8 = _rfm69_data.noise8;
+    uint16_t rssi8  = (uint16_t)_readreg(HRF_ADDR_RSSIVALUE) * 8;
+
+    if (rssi8 > floor8) {floor8 += (rssi8 - floor8) / 4;}
+    else                {floor8 -= (floor8 - rssi8) / 32;}
+    _rfm69_data.noise8 = floor8;
+
+    uint8_t thresh = (floor8 / 8) - NOISE_MARGIN;
+    if (thresh < NOISE_THRESH_MIN) {thresh = NOISE_THRESH_MIN;}
+    if (thresh > NOISE_THRESH_MAX) {thresh = NOISE_THRESH_MAX;}
+
+    uint8_t diff = (thresh > _rfm69_data.noise_thresh)
+                 ? thresh - _rfm69_data.noise_thresh
+                 : _rfm69_data.noise_thresh - thresh;
+    if (diff >= NOISE_HYST)
+    {
+        _writereg_cached(HRF_ADDR_RSSITHRESH, thresh);
+        _rfm69_data.noise_thresh = thresh;
+    }
+}
+#endif
+
+
+//------------------------------------------------------------------------------
+// Listen mode.
+// The radio cycles by itself on its RC oscillator, idle for LISTEN_COEF_IDLE
+// x 4.1ms then receiving for LISTEN_COEF_RX x 64us. If RSSI goes over
+// RSSITHRESH in a receive window it stays in receive until PayloadReady (or
+// LISTEN_TIMEOUT, if it was only noise) and then carries on cycling
+// (ListenEnd=10, the chip default of 01 would drop to standby and stay
+// there, with ListenOn still set). The FIFO is kept until the next receive
+// window, so once DIO0 has woken the CPU it has a whole idle period (4.1ms)
+// to read the payload out.
+//
+// The duty cycle and capture figures below are estimates, worked out from
+// the datasheet timings. Neither has been measured, and the RC oscillator
+// is only good to a few percent.
+// A CC frame has 00 00 66 66 66 before the sync word (66 2D D4), which is
+// 9.8ms of carrier at 4096bps. The most a frame can wait to be noticed is
+// one idle plus one receive window, 6.7ms, leaving 3ms for the receiver to
+// settle and find sync, so any frame that arrives with its whole preamble
+// should be caught. The receiver is on for 2.56 of every 6.66ms, an
+// estimated 38% of the time, so about 6mA on average instead of 16mA.
+// That is with no false wakes: each time noise gets over RSSITHRESH the
+// receiver is held on for LISTEN_TIMEOUT (78ms), so at the default -114dBm
+// threshold in a noisy place the average can be much nearer 16mA (a higher
+// RSSITHRESH helps, at the cost of range).
+// ListenOn can only be set from standby, and clearing it needs ListenAbort.
+
+#if defined(RFM69_LISTEN)
+static void _listen_setup(void)
+{
+    _shadow_set(HRF_ADDR_LISTEN1,    HRF_VAL_LISTEN1_RSSI);
+    _shadow_set(HRF_ADDR_LISTEN2,    LISTEN_COEF_IDLE);
+    _shadow_set(HRF_ADDR_LISTEN3,    LISTEN_COEF_RX);
+    _shadow_set(HRF_ADDR_RXTIMEOUT2, LISTEN_TIMEOUT);
+    _shadow_flush();
+}
+
+static void _listen_abort(void)
+{
+    _writereg(HRF_ADDR_OPMODE, HRF_MODE_STANDBY|HRF_MASK_LISTENABORT);
+    // ListenAbort reads back as 0, so the mode must be written again after
+    _flag_clr(_shadow.known, HRF_ADDR_OPMODE - SHADOW_FIRST);
+}
+#endif
+
+
+//------------------------------------------------------------------------------
+// In listen mode the Mode bits may follow the idle/receive cycle, so only
+// ListenOn is compared.
+
+static bool _mode_is(uint8_t opmode, RFM69_MODE mode)
+{
+#if defined(RFM69_LISTEN)
+    if (mode == RFM69_MODE_LISTEN)
+    {
+        return (opmode & HRF_MASK_LISTENON) != 0;
+    }
+#endif
+    return opmode == _hrf_modes[mode];
+}
+
+
+//------------------------------------------------------------------------------
+static bool _config_matches(RFM69_CONFIG config)
+{
+    // both halves are always read, so that the shadow learns all of them
+    bool same = _config_check(_configs[config].config, _configs[config].count);
+    return _config_check(_configs[config].packet, _configs[config].packet_count) && same;
+}
+
+
 //===== PUBLIC =================================================================
 
+#if (RFM69_RADIOS > 1)
+//------------------------------------------------------------------------------
+// All the other calls work on this radio until the next rfm69_select().
+// Each radio has to be selected and rfm69_init()'d before use.
+
+void rfm69_select(uint8_t radio)
+{
+    if (radio < RFM69_RADIOS)
+    {
+        _radio = &_radios[radio];
+        spi_device(radio);
+    }
+}
+#endif
+
 //------------------------------------------------------------------------------
 RFM69_RESULT rfm69_init(void)
 {
     _rfm69_data.radiover = _readreg(HRF_ADDR_VERSION);
     _rfm69_data.config   = RFM69_CONFIG_NONE;
+    _shadow_forget();
 
     if ((0x00 == _rfm69_data.radiover) || (0xFF == _rfm69_data.radiover))
     {
         return RFM69_RESULT_E_NORESPONSE;
     }
+
+#if defined(RFM69_NOISE)
+    // start from the chip default and let the floor come up to meet it
+    _rfm69_data.noise_polls  = 0;
+    _rfm69_data.noise8       = (uint16_t)(NOISE_THRESH_MAX + NOISE_MARGIN) * 8;
+    _rfm69_data.noise_thresh = NOISE_THRESH_MAX;
+    _writereg_cached(HRF_ADDR_RSSITHRESH, NOISE_THRESH_MAX);
+#endif
+
+#if defined(RFM69_IRQ)
+    RADIO_IRQ_AS_IN();
+    _writereg_cached(HRF_ADDR_DIOMAPPING1, DIO0_MAPPING);
+    RADIO_IRQ_ENABLE();
+#endif
     return RFM69_RESULT_OK;
 }
 
@@ -388,22 +1023,38 @@ uint8_t rfm69_radiover(void)
 //------------------------------------------------------------------------------
 RFM69_RESULT rfm69_setmode(RFM69_MODE mode)
 {
-    // Prevent HRF_MODE leaking via API
-    static uint8_t _hrf_modes[] =
-    {
-        /* RFM69_MODE_STBY */ HRF_MODE_STANDBY,
-        /* RFM69_MODE_RX   */ HRF_MODE_RECEIVER,
-        /* RFM69_MODE_TX   */ HRF_MODE_TRANSMITTER
-    };
     if (mode >= sizeof(_hrf_modes)) {return RFM69_RESULT_E_INVALID_PARAMETER;}
 
-    uint8_t hrf_mode = _hrf_modes[mode];
-    _writereg(HRF_ADDR_OPMODE, hrf_mode);
-    _wait_ready();
-
-    if (hrf_mode == HRF_MODE_TRANSMITTER)
+#if defined(RFM69_LISTEN)
+    if ((mode != RFM69_MODE_LISTEN) && (_rfm69_data.current_mode == RFM69_MODE_LISTEN))
     {
-        _wait_tx_ready();
+        _listen_abort();
+    }
+    else if ((mode == RFM69_MODE_LISTEN) && (_rfm69_data.current_mode != RFM69_MODE_LISTEN))
+    {
+        RFM69_RESULT result = rfm69_setmode(RFM69_MODE_STBY);
+        if (RFM69_RESULT_OK != result)
+        {
+            return result;
+        }
+        _listen_setup();
+    }
+#endif
+
+    uint8_t hrf_mode = _hrf_modes[mode];
+    if (_writereg_cached(HRF_ADDR_OPMODE, hrf_mode) && (hrf_mode != HRF_MODE_LISTEN))
+    {   // only wait if the mode actually changed, ModeReady means nothing in listen
+        bool ready = _wait_ready();
+
+        if (ready && (hrf_mode == HRF_MODE_TRANSMITTER))
+        {
+            ready = _wait_tx_ready();
+        }
+        if (! ready)
+        {   // not sure what the radio is doing, so the next setmode rewrites it
+            _flag_clr(_shadow.known, HRF_ADDR_OPMODE - SHADOW_FIRST);
+            return RFM69_RESULT_E_TIMEOUT;
+        }
     }
     //else if (mode == HRF_MODE_RECEIVER)
     //{
@@ -427,7 +1078,80 @@ RFM69_RESULT rfm69_setconfig(RFM69_CONFIG config)
     {
         //ser_txstr("new config\r\n");
         _config(_configs[config].config, _configs[config].count);
+        _config(_configs[config].packet, _configs[config].packet_count);
+        _shadow_flush();
         _rfm69_data.config = config;
+#if defined(RFM69_FEI)
+        _fei_reset(); // back on the config's carrier
+#endif
+#if defined(CONFIG_VERIFY)
+        RFM69_RESULT result = rfm69_checkconfig(config);
+        if (RFM69_RESULT_OK != result)
+        {
+            // trust neither the shadow nor the config, so a retry writes it all
+            _shadow_forget();
+            _rfm69_data.config = RFM69_CONFIG_NONE;
+        }
+        return result;
+#endif
+    }
+    return RFM69_RESULT_OK;
+}
+
+//------------------------------------------------------------------------------
+RFM69_RESULT rfm69_checkconfig(RFM69_CONFIG config)
+{
+    if ( config >= NUM_CONFIGS)
+    {
+        return RFM69_RESULT_E_INVALID_PARAMETER;
+    }
+
+    if (! _config_matches(config))
+    {
+        return RFM69_RESULT_E_VERIFY;
+    }
+    return RFM69_RESULT_OK;
+}
+
+//------------------------------------------------------------------------------
+// After an MCU-only reset (brownout, watchdog, reset pin) the radio keeps
+// its registers and may still be listening. If it is already in 'mode' with
+// 'config' loaded, adopt that state and skip the reconfiguration.
+
+RFM69_RESULT rfm69_warmstart(RFM69_CONFIG config, RFM69_MODE mode)
+{
+    if ((config >= NUM_CONFIGS) || (mode >= sizeof(_hrf_modes)))
+    {
+        return RFM69_RESULT_E_INVALID_PARAMETER;
+    }
+
+    if ((! _mode_is(_readreg(HRF_ADDR_OPMODE), mode)) || (! _config_matches(config)))
+    {
+        return RFM69_RESULT_I_COLDSTART;
+    }
+    _shadow_learn(HRF_ADDR_OPMODE, _hrf_modes[mode]);
+
+    _rfm69_data.config       = config;
+    _rfm69_data.current_mode = mode;
+    return RFM69_RESULT_OK;
+}
+
+//------------------------------------------------------------------------------
+// Cheap check that the radio is still there and still in the mode it was
+// put in, for a supervisor to call every so often. A radio that has been
+// reset (e.g. by a supply glitch) comes back in standby with its default
+// registers, so OPMODE catches that without reading back the whole config.
+// returns: OK, E_NORESPONSE, or E_VERIFY if the mode has changed.
+
+RFM69_RESULT rfm69_health(void)
+{
+    if (_readreg(HRF_ADDR_VERSION) != _rfm69_data.radiover)
+    {
+        return RFM69_RESULT_E_NORESPONSE;
+    }
+    if (! _mode_is(_readreg(HRF_ADDR_OPMODE), _rfm69_data.current_mode))
+    {
+        return RFM69_RESULT_E_VERIFY;
     }
     return RFM69_RESULT_OK;
 }
@@ -438,6 +1162,31 @@ RFM69_CONFIG rfm69_getconfig(void)
     return _rfm69_data.config;
 }
 
+//------------------------------------------------------------------------------
+// Drop packets in the radio unless the first byte after the sync word is
+// 'node' or 'broadcast', so they are never read out over SPI.
+// The byte is compared after any manchester decoding the config does, so
+// with RFM69_CONFIG_CC_FSK_MANCH it is the CC type:id byte, but with
+// RFM69_CONFIG_CC_FSK it is the raw encoding of the type nybble only.
+// Call after rfm69_setconfig(), a change of config turns it off again.
+
+RFM69_RESULT rfm69_setaddress(uint8_t node, uint8_t broadcast)
+{
+    if (_rfm69_data.config == RFM69_CONFIG_NONE)
+    {
+        return RFM69_RESULT_E_INVALID_PARAMETER;
+    }
+
+    uint8_t packetconfig1 = _shadow.value[HRF_ADDR_PACKETCONFIG1 - SHADOW_FIRST];
+    packetconfig1 = (packetconfig1 & ~HRF_MASK_ADDRESSFILTERING) | HRF_VAL_ADDRESSFILTERING_BOTH;
+
+    _shadow_set(HRF_ADDR_PACKETCONFIG1, packetconfig1);
+    _shadow_set(HRF_ADDR_NODEADRS,      node);
+    _shadow_set(HRF_ADDR_BROADCASTADRS, broadcast);
+    _shadow_flush();
+    return RFM69_RESULT_OK;
+}
+
 //------------------------------------------------------------------------------
 RFM69_RESULT rfm69_tx(uint8_t * ppayload, uint8_t len, uint8_t times)
 {
@@ -458,7 +1207,11 @@ RFM69_RESULT rfm69_tx(uint8_t * ppayload, uint8_t len, uint8_t times)
     uint8_t prevmode = _rfm69_data.current_mode;
     if (prevmode != RFM69_MODE_TX)
     {
-        rfm69_setmode(RFM69_MODE_TX);
+        RFM69_RESULT result = rfm69_setmode(RFM69_MODE_TX);
+        if (RFM69_RESULT_IS_ERROR(result))
+        {
+            return result;
+        }
     }
 
     // Note, when PA starts up, radio inserts a 01 at start before any user data
@@ -474,24 +1227,29 @@ RFM69_RESULT rfm69_tx(uint8_t * ppayload, uint8_t len, uint8_t times)
     // level triggers when it 'strictly exceeds' level (i.e. 16 bytes starts tx,
     // and <=15 bytes triggers fifolevel irqflag to be cleared)
     // We already know from earlier that payloadlen<=32 (which fits into half a FIFO)
-    _writereg(HRF_ADDR_FIFOTHRESH, len-1);
+    _writereg_cached(HRF_ADDR_FIFOTHRESH, len-1);
 
 
     /* TRANSMIT: Transmit a number of payloads back to back */
 
     // send a number of payload repeats for the whole packet burst
-    for (uint8_t i=0; i<times; i++)
+    bool sent = true;
+    for (uint8_t i=0; (i<times) && sent; i++)
     {
         _writefifo_burst(ppayload, len);
         // Tx will auto start when fifolevel is exceeded by loading the payload
         // so the level register must be correct for the size of the payload
         // otherwise transmit will never start.
         /* wait for FIFO to not exceed threshold level */
-        _waitreg(HRF_ADDR_IRQFLAGS2, HRF_MASK_FIFOLEVEL, 0);
+        sent = _waitreg(HRF_ADDR_IRQFLAGS2, HRF_MASK_FIFOLEVEL, 0, TX_TIMEOUT_MS);
     }
 
     // wait for FIFO empty, to indicate transmission completed
-    _waitreg(HRF_ADDR_IRQFLAGS2, HRF_MASK_FIFONOTEMPTY, 0);
+    sent = sent && _waitreg(HRF_ADDR_IRQFLAGS2, HRF_MASK_FIFONOTEMPTY, 0, TX_TIMEOUT_MS);
+    // the last byte is still being shifted out when the FIFO empties, and
+    // leaving TX now would cut it off, so also wait for PacketSent
+    // (which stays set from the first copy onwards if times > 1)
+    sent = sent && _waitreg(HRF_ADDR_IRQFLAGS2, HRF_MASK_PACKETSENT, HRF_MASK_PACKETSENT, TX_TIMEOUT_MS);
 
     // Check final flags in case of overruns etc
     //uint8_t irqflags1 = _readreg(HRF_ADDR_IRQFLAGS1);
@@ -503,6 +1261,10 @@ RFM69_RESULT rfm69_tx(uint8_t * ppayload, uint8_t len, uint8_t times)
     }
 
     /* CONFIRM: Was the transmit ok? */
+    if (! sent)
+    {
+        return RFM69_RESULT_E_TIMEOUT;
+    }
     if (((irqflags2 & HRF_MASK_FIFONOTEMPTY) != 0) || ((irqflags2 & HRF_MASK_FIFOOVERRUN) != 0))
     {
         return RFM69_RESULT_E_OVERRUN;
@@ -514,17 +1276,174 @@ RFM69_RESULT rfm69_tx(uint8_t * ppayload, uint8_t len, uint8_t times)
 //------------------------------------------------------------------------------
 RFM69_RESULT rfm69_receive_waiting(void)
 {
+#if defined(PAYLOAD_ON_DIO0)
+    // DIO0 follows PayloadReady, so no SPI traffic is needed to poll it
+    if (RADIO_IRQ_IS_HIGH())
+    {
+#if defined(RFM69_RSSI)
+        _rssi_take(); // the CPU slept through the sync, so one extra read here
+#endif
+        return RFM69_RESULT_I_READY;
+    }
+    return RFM69_RESULT_I_NOTREADY;
+#else
+    // (in listen mode DIO0 drops when the radio goes back to idle, with the
+    // payload still in the FIFO, so the flag has to be read over SPI)
+#if defined(WATCH_SYNC)
+    // IRQFLAGS1 comes along in the same burst for one more byte, so RSSI
+    // and FEI can be taken at sync time, while the radio is busy receiving
+    // anyway, rather than adding transactions between PayloadReady and
+    // the drain.
+    uint8_t irqflags1;
+    uint8_t irqflags2;
+
+    spi_select();
+    spi_byte(HRF_ADDR_IRQFLAGS1);
+    irqflags1 = spi_byte(0x00);
+    irqflags2 = spi_byte(0x00);
+    spi_deselect();
+
+    if ((irqflags1 & HRF_MASK_SYNCADDRESSMATCH) == HRF_MASK_SYNCADDRESSMATCH)
+    {
+        // Only while the packet is still arriving. If PayloadReady is
+        // already set the sync was seen late, and RSSI and FEI would
+        // measure the noise after the packet, so this one goes without.
+        if ((irqflags2 & HRF_MASK_PAYLOADRDY) == 0)
+        {
+#if defined(RFM69_RSSI)
+            _rssi_sample();
+#endif
+#if defined(RFM69_FEI)
+            _fei_start();
+#endif
+        }
+    }
+#if defined(RFM69_NOISE)
+    else if ((irqflags2 & HRF_MASK_PAYLOADRDY) == 0)
+    {
+        _noise_sample();
+    }
+#endif
+#else
     uint8_t irqflags2 = _readreg(HRF_ADDR_IRQFLAGS2);
+#endif
 
     if ((irqflags2 & HRF_MASK_PAYLOADRDY) == HRF_MASK_PAYLOADRDY)
     {
+#if defined(RFM69_RSSI)
+        _rssi_done();
+#endif
+#if defined(RFM69_FEI)
+        _fei_packet(); // only if _fei_start() saw this one arriving
+#endif
         return RFM69_RESULT_I_READY;
     }
     else
     {
         return RFM69_RESULT_I_NOTREADY;
     }
+#endif
+}
+
+
+//------------------------------------------------------------------------------
+// RSSI of the packet last reported by rfm69_receive_waiting() or
+// rfm69_sync_waiting(), as RSSIVALUE: -dBm*2, so 0x90 is -72dBm
+
+#if defined(RFM69_RSSI)
+uint8_t rfm69_rssi(void)
+{
+    return _rfm69_data.rssi;
+}
+#endif
+
+
+//------------------------------------------------------------------------------
+// Current noise floor estimate and the RSSITHRESH it has set, -dBm*2.
+
+#if defined(RFM69_NOISE)
+uint8_t rfm69_noise_floor(void)
+{
+    return _rfm69_data.noise8 / 8;
+}
+
+uint8_t rfm69_rssi_thresh(void)
+{
+    return _rfm69_data.noise_thresh;
 }
+#endif
+
+
+//------------------------------------------------------------------------------
+// Call when the packet just received has been checked and is good.
+// Its FEI goes into a running average, and once that is more than
+// FEI_RETUNE out, the carrier is moved onto it. Transmitters drift slowly
+// (temperature), so this keeps them in the middle of RXBW without having
+// to widen it.
+// returns: OK, or I_NOPAYLOAD if there was no FEI for this packet.
+
+#if defined(RFM69_FEI)
+RFM69_RESULT rfm69_fei_track(void)
+{
+    uint8_t regs[5]; // AFCFEI AFCMSB AFCLSB FEIMSB FEILSB
+
+    if (_rfm69_data.fei_state != FEI_PACKET)
+    {
+        return RFM69_RESULT_I_NOPAYLOAD;
+    }
+    _rfm69_data.fei_state = FEI_IDLE;
+
+    spi_select();
+    spi_byte(HRF_ADDR_AFCFEI);
+    spi_bytes(NULL, regs, sizeof(regs));
+    spi_deselect();
+
+    if ((regs[0] & HRF_MASK_FEIDONE) == 0)
+    {
+        return RFM69_RESULT_I_NOPAYLOAD;
+    }
+
+    // FEI is the transmitter's offset from our carrier, in Fsteps of 61Hz
+    int16_t fei = (int16_t)(((uint16_t)regs[3] << 8) | regs[4]);
+    if ((fei > FEI_MAX) || (fei < -FEI_MAX))
+    {
+        return RFM69_RESULT_I_NOPAYLOAD;
+    }
+    _rfm69_data.fei_est8 += fei - (_rfm69_data.fei_est8 / 8);
+
+    if (_rfm69_data.fei_samples < FEI_MIN_SAMPLES)
+    {
+        _rfm69_data.fei_samples++;
+        return RFM69_RESULT_OK;
+    }
+
+    int16_t est = _rfm69_data.fei_est8 / 8;
+    if ((est >= FEI_RETUNE) || (est <= -FEI_RETUNE))
+    {
+        int16_t offset = _rfm69_data.fei_offset + est;
+        if (offset > FEI_RANGE)  {offset = FEI_RANGE;}
+        if (offset < -FEI_RANGE) {offset = -FEI_RANGE;}
+
+        if (offset != _rfm69_data.fei_offset)
+        {
+            _fei_retune(offset - _rfm69_data.fei_offset);
+            _rfm69_data.fei_offset  = offset;
+            _rfm69_data.fei_est8    = 0; // now measured from the new carrier
+            _rfm69_data.fei_samples = 0;
+        }
+    }
+    return RFM69_RESULT_OK;
+}
+
+
+//------------------------------------------------------------------------------
+// How far the carrier has been moved from the config, in Fsteps (61.035Hz).
+
+int16_t rfm69_fei_offset(void)
+{
+    return _rfm69_data.fei_offset;
+}
+#endif
 
 
 //------------------------------------------------------------------------------
@@ -581,8 +1500,8 @@ RFM69_RESULT rfm69_rxcbp(uint8_t * ppayload, uint8_t maxlen)
 RFM69_RESULT rfm69_rx(uint8_t * ppayload, uint8_t maxlen)
 {
     if (maxlen > MAX_FIFO_BUFFER)
-    {  /* At the moment, the receiver cannot reliably cope with payloads > 1 FIFO buffer.
-        * It *might* be able to in the future.
+    {  /* This is read after PayloadReady, so it cannot cope with payloads
+        * > 1 FIFO buffer. Use rfm69_rxstream() for those.
         */
         return RFM69_RESULT_E_LONG_PAYLOAD;
     }
@@ -607,4 +1526,107 @@ RFM69_RESULT rfm69_rx(uint8_t * ppayload, uint8_t maxlen)
     return RFM69_RESULT_OK;
 }
 
+
+//------------------------------------------------------------------------------
+// Discard whatever is left of the current payload and listen again at once.
+// Use after rfm69_rx() has read enough of a payload to know it is junk.
+
+RFM69_RESULT rfm69_rx_abort(void)
+{
+    _restart_rx();
+    return RFM69_RESULT_OK;
+}
+
+
+#if defined(RFM69_STREAM)
+//------------------------------------------------------------------------------
+RFM69_RESULT rfm69_sync_waiting(void)
+{
+#if defined(RFM69_IRQ)
+    // DIO0 follows SyncAddress, so no SPI traffic is needed to poll it
+    if (RADIO_IRQ_IS_HIGH())
+#else
+    if (_checkreg(HRF_ADDR_IRQFLAGS1, HRF_MASK_SYNCADDRESSMATCH, HRF_MASK_SYNCADDRESSMATCH))
+#endif
+    {
+#if defined(RFM69_RSSI)
+        _rssi_take(); // packet is still arriving, so this costs nothing
+#endif
+#if defined(RFM69_FEI)
+        _fei_start();
+        _fei_packet(); // the app reads this packet next
+#endif
+        return RFM69_RESULT_I_READY;
+    }
+#if defined(RFM69_NOISE)
+    _noise_sample();
+#endif
+    return RFM69_RESULT_I_NOTREADY;
+}
+
+
+//------------------------------------------------------------------------------
+// Set the fixed payload length. PAYLOADLEN is only 8 bits, so anything
+// longer uses unlimited length mode, and rfm69_rxstream() restarts the
+// receiver once it has read 'len' bytes.
+
+RFM69_RESULT rfm69_setpayloadlen(uint16_t len)
+{
+    if (len == 0)
+    {
+        return RFM69_RESULT_E_INVALID_PARAMETER;
+    }
+    _writereg_cached(HRF_ADDR_PAYLOADLEN, (len > 255) ? 0 : len);
+    return RFM69_RESULT_OK;
+}
+
+
+//------------------------------------------------------------------------------
+// Receive a payload while it is still arriving, call after sync is seen.
+// The FIFO threshold is set so that FifoLevel rises once a whole chunk is
+// in, and each chunk is burst read and passed to 'handler' straight away.
+// The tail of the payload (less than a chunk) is read a byte at a time.
+// returns: OK, I_ABORTED if the handler gave up, E_TIMEOUT if data stopped.
+
+RFM69_RESULT rfm69_rxstream(uint16_t len, RFM69_STREAM_FN handler)
+{
+    uint8_t chunk[RFM69_STREAM_CHUNK];
+    RFM69_RESULT result = RFM69_RESULT_OK;
+
+    // FifoLevel is set when the FIFO holds more than FIFOTHRESH bytes
+    _writereg_cached(HRF_ADDR_FIFOTHRESH, HRF_MASK_TXSTART_NOTEMPTY | (RFM69_STREAM_CHUNK-1));
+
+    while (len != 0)
+    {
+        uint8_t n    = (len >= RFM69_STREAM_CHUNK) ? RFM69_STREAM_CHUNK : 1;
+        uint8_t mask = (n == RFM69_STREAM_CHUNK) ? HRF_MASK_FIFOLEVEL : HRF_MASK_FIFONOTEMPTY;
+
+        if (! _waitreg(HRF_ADDR_IRQFLAGS2, mask, mask, STREAM_TIMEOUT_MS))
+        {
+            result = RFM69_RESULT_E_TIMEOUT;
+            break;
+        }
+
+        spi_select();
+        spi_byte(HRF_ADDR_FIFO); /* prime the fifo burst reader */
+        spi_bytes(NULL, chunk, n);
+        spi_deselect();
+        len -= n;
+
+        if (! handler(chunk, n))
+        {
+            result = RFM69_RESULT_I_ABORTED;
+            break;
+        }
+    }
+
+    // A fixed length packet that was read to the end restarts by itself
+    if ((len != 0) || (_shadow.value[HRF_ADDR_PAYLOADLEN - SHADOW_FIRST] == 0))
+    {
+        _restart_rx();
+    }
+    return result;
+}
+#endif
+
 // END
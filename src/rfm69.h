@@ -5,6 +5,7 @@
 #define RFM69_H 1
 
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef uint8_t RFM69_RESULT;
 #define RFM69_RESULT_IS_ERROR(R) (((R)&0x80) == 0x80)
@@ -13,6 +14,8 @@ typedef uint8_t RFM69_RESULT;
 #define RFM69_RESULT_I_NOPAYLOAD         0x02
 #define RFM69_RESULT_I_READY             0x03
 #define RFM69_RESULT_I_NOTREADY          0x04
+#define RFM69_RESULT_I_COLDSTART         0x05
+#define RFM69_RESULT_I_ABORTED           0x06
 
 #define RFM69_RESULT_E_NORESPONSE        0x80
 #define RFM69_RESULT_E_WRONGVER          0x81
@@ -20,6 +23,8 @@ typedef uint8_t RFM69_RESULT;
 #define RFM69_RESULT_E_INVALID_PARAMETER 0x83
 #define RFM69_RESULT_E_OVERRUN           0x84
 #define RFM69_RESULT_E_LONG_PAYLOAD      0x85
+#define RFM69_RESULT_E_VERIFY            0x86
+#define RFM69_RESULT_E_TIMEOUT           0x87
 
 #define RFM69_RESULT_E_UNIMPLEMENTED     0xFF
 
@@ -29,26 +34,70 @@ typedef uint8_t RFM69_RESULT;
 
 #define RFM69_MTU 66
 
+// Streaming receive (RFM69_STREAM) hands the payload over in chunks of this
+// many bytes, as they arrive, so payloads are not limited by RFM69_MTU.
+// The handler returns false to abandon the rest of the packet.
+#define RFM69_STREAM_CHUNK 2
+typedef bool (*RFM69_STREAM_FN)(uint8_t * pchunk, uint8_t len);
+
+// Radios on the one SPI bus, each with its own CS (see port.h).
+// Set with -DRFM69_RADIOS=2 in build/makefile.
+#if !defined(RFM69_RADIOS)
+#define RFM69_RADIOS 1
+#endif
+
 typedef uint8_t RFM69_MODE;
 #define RFM69_MODE_STBY 0
 #define RFM69_MODE_RX 1
 #define RFM69_MODE_TX 2
+#if defined(RFM69_LISTEN)
+#define RFM69_MODE_LISTEN 3  // radio duty cycles itself, see rfm69.c
+#endif
 
 typedef uint8_t RFM69_CONFIG;
-#define RFM69_CONFIG_CC_FSK     0
-#define RFM69_CONFIG_NONE       255
+#define RFM69_CONFIG_CC_FSK       0    // raw manchester in the FIFO
+#define RFM69_CONFIG_CC_FSK_MANCH 1    // radio decodes the manchester
+#define RFM69_CONFIG_OT_FSK       2    // OpenThings (Energenie) 434.3MHz
+#define RFM69_CONFIG_NONE         255
 
+#if (RFM69_RADIOS > 1)
+void rfm69_select(uint8_t radio);
+#endif
 RFM69_RESULT rfm69_init(void);
 uint8_t rfm69_radiover(void);
 
 RFM69_RESULT rfm69_setmode(RFM69_MODE mode);
 RFM69_RESULT rfm69_setconfig(RFM69_CONFIG config);
 RFM69_CONFIG rfm69_getconfig(void);
+RFM69_RESULT rfm69_checkconfig(RFM69_CONFIG config);
+RFM69_RESULT rfm69_warmstart(RFM69_CONFIG config, RFM69_MODE mode);
+RFM69_RESULT rfm69_setaddress(uint8_t node, uint8_t broadcast);
+RFM69_RESULT rfm69_health(void);
 RFM69_RESULT rfm69_tx(uint8_t * ppayload, uint8_t len, uint8_t times);
 
 RFM69_RESULT rfm69_receive_waiting(void);
+#if defined(RFM69_RSSI)
+uint8_t rfm69_rssi(void);
+#define RFM69_RSSI_UNKNOWN 0xFF // sync was seen too late to measure, weakest
+#endif
+#if defined(RFM69_NOISE)
+uint8_t rfm69_noise_floor(void);
+uint8_t rfm69_rssi_thresh(void);
+#endif
+#if defined(RFM69_FEI)
+#define RFM69_FSTEP_HZ 61  // 32MHz/2^19, rounded
+RFM69_RESULT rfm69_fei_track(void);
+int16_t rfm69_fei_offset(void);
+#endif
 RFM69_RESULT rfm69_rxcbp(uint8_t * ppayload, uint8_t maxlen);
 RFM69_RESULT rfm69_rx(uint8_t * ppayload, uint8_t maxlen);
+RFM69_RESULT rfm69_rx_abort(void);
+
+#if defined(RFM69_STREAM)
+RFM69_RESULT rfm69_sync_waiting(void);
+RFM69_RESULT rfm69_setpayloadlen(uint16_t len);
+RFM69_RESULT rfm69_rxstream(uint16_t len, RFM69_STREAM_FN handler);
+#endif
 
 #endif
 
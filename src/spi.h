@@ -17,15 +17,30 @@
 #define SPI_CSPOL0 0x00
 #define SPI_CSPOL1 0x04
 
+// The mode is fixed at compile time, so the drivers have no runtime tests
+// on the clock edges. Override with -DSPI_MODE=... in build/makefile.
+#if !defined(SPI_MODE)
+#define SPI_MODE (SPI_CPOL0|SPI_CPHA0|SPI_CSPOL1)
+#endif
+
+// Software driver only: settle time per clock phase.
+// 0 runs flat out (about 650kHz at 8MHz), which the RFM69 copes with easily.
+#if !defined(SPI_DELAY_US)
+#define SPI_DELAY_US 0
+#endif
+
 
 /***** FUNCTION PROTOTYPES *****/
 
-void spi_init(uint8_t mode);
+void spi_init(uint8_t mode); // mode must be SPI_MODE
 
 void spi_select(void);
 
 void spi_deselect(void);
 
+// Only with SPI_CS2 in port.h, picks the CS line for the next spi_select()
+void spi_device(uint8_t device);
+
 uint8_t spi_byte(uint8_t txbyte);
 
 void spi_bytes(uint8_t* pTx, uint8_t* pRx, uint8_t count);
@@ -9,30 +9,73 @@
 #include "port.h"
 #include "timer.h"
 
+// All of the mode handling is resolved by the preprocessor from SPI_MODE
+// (see spi.h), so each clock edge is a single port instruction.
+
 // CS
 // CSPOL0 = low when idle, high when active
 // CSPOL1 = high when idle, low when active
-#define DESELECT() do { if (_mode & SPI_CSPOL1) SPI_CS_HIGH(); else SPI_CS_LOW();} while (0)
-#define SELECT()   do { if (_mode & SPI_CSPOL1) SPI_CS_LOW();  else SPI_CS_HIGH();} while (0)
+// With SPI_CS2 (see port.h) spi_device() picks which CS line these drive.
+#if defined(SPI_CS2)
+static uint8_t cs_mask = SPI_CS_MASK;
+#define CS_HIGH()      PORTB |=   cs_mask
+#define CS_LOW()       PORTB &= ~ cs_mask
+#else
+#define CS_HIGH()      SPI_CS_HIGH()
+#define CS_LOW()       SPI_CS_LOW()
+#endif
+
+#if (SPI_MODE & SPI_CSPOL1)
+#define DESELECT()     CS_HIGH()
+#define SELECT()       CS_LOW()
+#else
+#define DESELECT()     CS_LOW()
+#define SELECT()       CS_HIGH()
+#endif
 
 // CLOCK
 // CPOL0 = low when idle, high when active
 // CPOL1 = high when idle, low when active
-#define CLOCK_IDLE()   do { if (_mode & SPI_CPOL1) SPI_SCLK_HIGH(); else SPI_SCLK_LOW();} while (0)
-#define CLOCK_ACTIVE() do { if (_mode & SPI_CPOL1) SPI_SCLK_LOW();  else SPI_SCLK_HIGH();} while (0)
+#if (SPI_MODE & SPI_CPOL1)
+#define CLOCK_IDLE()   SPI_SCLK_HIGH()
+#define CLOCK_ACTIVE() SPI_SCLK_LOW()
+#else
+#define CLOCK_IDLE()   SPI_SCLK_LOW()
+#define CLOCK_ACTIVE() SPI_SCLK_HIGH()
+#endif
 
 // Timing
-#define DELAY_FREQ_US      1
-#define DELAY_CS_SETTLE_US 1
-#define DELAY_TX_SETTLE_US 1
-
-static uint8_t _mode = 0;
+#if (SPI_DELAY_US > 0)
+#define DELAY()        timer_delay_us(SPI_DELAY_US)
+#else
+#define DELAY()
+#endif
+
+// One bit, MSB first, M is the mask of the bit within the byte.
+// The data tests compile to skip instructions (sbrc/sbic), not jumps.
+#define MOSI_BIT(M)    do { SPI_MOSI_LOW(); if (txbyte & (M)) SPI_MOSI_HIGH();} while (0)
+#define MISO_BIT(M)    do { if (SPI_MISO_IS_HIGH()) rxbyte |= (M);} while (0)
+
+#if (SPI_MODE & SPI_CPHA1)
+// CPHA1 = data changes on leading edge, sampled on trailing edge
+#define BIT(M) do { \
+    CLOCK_ACTIVE(); MOSI_BIT(M); DELAY(); \
+    MISO_BIT(M);    CLOCK_IDLE(); DELAY(); \
+} while (0)
+#else
+// CPHA0 = data valid before leading edge, sampled on leading edge
+#define BIT(M) do { \
+    MOSI_BIT(M);    DELAY(); CLOCK_ACTIVE(); DELAY(); \
+    MISO_BIT(M);    CLOCK_IDLE(); \
+} while (0)
+#endif
 
 
 //------------------------------------------------------------------------------
 void spi_init(uint8_t mode)
 {
-    _mode = mode;
+    (void)mode; // fixed at compile time by SPI_MODE
+
     SPI_SCLK_AS_OUT();
     CLOCK_IDLE();
 
@@ -40,7 +83,15 @@ void spi_init(uint8_t mode)
     SPI_MOSI_LOW();
     SPI_MISO_AS_IN();
 
+#if defined(SPI_CS2)
+    uint8_t device = cs_mask;
+    cs_mask = SPI_CS_MASK | SPI_CS2_MASK; // both idle
     DESELECT();
+    cs_mask = device;
+    SPI_CS2_AS_OUT();
+#else
+    DESELECT();
+#endif
     SPI_CS_AS_OUT();
 }
 
@@ -50,6 +101,9 @@ void spi_finished(void)
 {
     SPI_MOSI_AS_IN();
     SPI_CS_AS_IN();
+#if defined(SPI_CS2)
+    SPI_CS2_AS_IN();
+#endif
 }
 
 
@@ -57,7 +111,7 @@ void spi_finished(void)
 void spi_select(void)
 {
     SELECT();
-    timer_delay_us(DELAY_CS_SETTLE_US);
+    DELAY();
 }
 
 
@@ -68,33 +122,23 @@ void spi_deselect(void)
 }
 
 
+#if defined(SPI_CS2)
+//------------------------------------------------------------------------------
+void spi_device(uint8_t device)
+{
+    cs_mask = (device == 0) ? SPI_CS_MASK : SPI_CS2_MASK;
+}
+#endif
+
+
 //------------------------------------------------------------------------------
 uint8_t spi_byte(uint8_t txbyte)
 {
     uint8_t rxbyte = 0;
-    uint8_t bitno;
-    uint8_t bit ;
 
-    //NOTE: This is for CPHA0 only
-    //TODO: Implement CPHA1
+    BIT(0x80); BIT(0x40); BIT(0x20); BIT(0x10);
+    BIT(0x08); BIT(0x04); BIT(0x02); BIT(0x01);
 
-    for (bitno=0; bitno<8; bitno++)
-    {
-        /* Transmit MSB first */
-        bit = ((txbyte & 0x80) != 0x00);
-        txbyte <<= 1;
-        SPI_MOSI_WRITE(bit);
-        timer_delay_us(DELAY_TX_SETTLE_US);
-        CLOCK_ACTIVE();
-        timer_delay_us(DELAY_FREQ_US);
-
-        /* Read MSB first */
-        bit = SPI_MISO_READ();
-        rxbyte = (rxbyte<<1) | bit;
-
-        CLOCK_IDLE();
-        timer_delay_us(DELAY_FREQ_US);
-    }
     return rxbyte;
 }
 
@@ -102,21 +146,20 @@ uint8_t spi_byte(uint8_t txbyte)
 //------------------------------------------------------------------------------
 void spi_bytes(uint8_t* pTx, uint8_t* pRx, uint8_t count)
 {
-    uint8_t tx = 0;
-    uint8_t rx;
-
-    while (count > 0)
+    // Resolve the NULL buffers once, so the loop body has no tests.
+    // A NULL tx sends repeated zeros, a NULL rx discards into a scratch byte.
+    static uint8_t zero = 0;
+    uint8_t scratch;
+    uint8_t txstep = (pTx != NULL);
+    uint8_t rxstep = (pRx != NULL);
+    if (pTx == NULL) {pTx = &zero;}
+    if (pRx == NULL) {pRx = &scratch;}
+
+    while (count-- != 0)
     {
-        if (pTx != NULL)
-        {
-            tx = *(pTx++);
-        }
-        rx = spi_byte(tx);
-        if (pRx != NULL)
-        {
-            *(pRx++) = rx;
-        }
-        count--;
+        *pRx = spi_byte(*pTx);
+        pTx += txstep;
+        pRx += rxstep;
     }
 }
 
@@ -125,7 +168,7 @@ void spi_bytes(uint8_t* pTx, uint8_t* pRx, uint8_t count)
 void spi_frame(uint8_t* pTx, uint8_t* pRx, uint8_t count)
 {
     SELECT();
-    timer_delay_us(DELAY_CS_SETTLE_US);
+    DELAY();
     spi_bytes(pTx, pRx, count);
     DESELECT();
 }
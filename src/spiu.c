@@ -0,0 +1,174 @@
+/* spiu.c  17/10/2026
+ * based on: spis.c  19/07/2014  D.J.Whale
+ *
+ * Hardware SPI driver, using the ATtiny85 USI in three wire mode.
+ *
+ * This is a drop-in replacement for spis.c, select it with SPI=spiu in
+ * build/makefile. The USI data pins are fixed (DO=PB1, DI=PB0, USCK=PB2),
+ * see port.h for the wiring this implies. CS is still a plain port pin.
+ *
+ * The clock is generated by software strobes of USITC, two per bit, fully
+ * unrolled, so SCLK runs at F_CPU/2 (4MHz at 8MHz). The RFM69 is good for
+ * 10MHz so no settle delays are needed. Estimated from instruction timings
+ * at 8MHz (not measured on a scope), a byte takes about 3us including call
+ * overhead, against about 40us for the bit-banged driver, so a 16 byte
+ * FIFO drain drops from roughly 700us to roughly 80us.
+ *
+ * The mode comes from SPI_MODE at compile time (see spi.h). Only CPHA0 is
+ * supported. The USI shifts on the trailing strobe, so CPHA1 would present
+ * the second bit on the first sampling edge.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "spi.h"
+#include "port.h"
+
+// CS
+// CSPOL0 = low when idle, high when active
+// CSPOL1 = high when idle, low when active
+// With SPI_CS2 (see port.h) spi_device() picks which CS line these drive.
+#if defined(SPI_CS2)
+static uint8_t cs_mask = SPI_CS_MASK;
+#define CS_HIGH()      PORTB |=   cs_mask
+#define CS_LOW()       PORTB &= ~ cs_mask
+#else
+#define CS_HIGH()      SPI_CS_HIGH()
+#define CS_LOW()       SPI_CS_LOW()
+#endif
+
+#if (SPI_MODE & SPI_CSPOL1)
+#define DESELECT()     CS_HIGH()
+#define SELECT()       CS_LOW()
+#else
+#define DESELECT()     CS_LOW()
+#define SELECT()       CS_HIGH()
+#endif
+
+// CLOCK
+// USITC toggles the port latch, so the idle level set at init is CPOL
+#if (SPI_MODE & SPI_CPOL1)
+#define CLOCK_IDLE()   SPI_SCLK_HIGH()
+#else
+#define CLOCK_IDLE()   SPI_SCLK_LOW()
+#endif
+
+#if (SPI_MODE & SPI_CPHA1)
+#error "spiu.c only supports CPHA0, use spis.c for CPHA1"
+#endif
+
+// USI control values, three wire mode, software clock strobe.
+// LEAD toggles USCK to the active level (slave samples DO).
+// TRAIL toggles USCK back to idle and shifts DI into USIDR.
+#define USI_LEAD  ((1<<USIWM0)|(1<<USITC))
+#define USI_TRAIL ((1<<USIWM0)|(1<<USITC)|(1<<USICLK))
+
+#define USI_BIT() do { USICR = USI_LEAD; USICR = USI_TRAIL;} while (0)
+
+
+//------------------------------------------------------------------------------
+void spi_init(uint8_t mode)
+{
+    (void)mode; // fixed at compile time by SPI_MODE
+
+    CLOCK_IDLE();
+    SPI_SCLK_AS_OUT();
+
+    SPI_MOSI_AS_OUT();
+    SPI_MOSI_LOW();
+    SPI_MISO_AS_IN();
+
+#if defined(SPI_CS2)
+    uint8_t device = cs_mask;
+    cs_mask = SPI_CS_MASK | SPI_CS2_MASK; // both idle
+    DESELECT();
+    cs_mask = device;
+    SPI_CS2_AS_OUT();
+#else
+    DESELECT();
+#endif
+    SPI_CS_AS_OUT();
+
+    USICR = (1<<USIWM0);
+}
+
+
+//------------------------------------------------------------------------------
+void spi_finished(void)
+{
+    USICR = 0;
+    SPI_MOSI_AS_IN();
+    SPI_CS_AS_IN();
+#if defined(SPI_CS2)
+    SPI_CS2_AS_IN();
+#endif
+}
+
+
+//------------------------------------------------------------------------------
+void spi_select(void)
+{
+    SELECT();
+}
+
+
+//------------------------------------------------------------------------------
+void spi_deselect(void)
+{
+    DESELECT();
+}
+
+
+#if defined(SPI_CS2)
+//------------------------------------------------------------------------------
+void spi_device(uint8_t device)
+{
+    cs_mask = (device == 0) ? SPI_CS_MASK : SPI_CS2_MASK;
+}
+#endif
+
+
+//------------------------------------------------------------------------------
+uint8_t spi_byte(uint8_t txbyte)
+{
+    USIDR = txbyte;
+
+    // unrolled, a loop would more than halve the clock rate
+    USI_BIT(); USI_BIT(); USI_BIT(); USI_BIT();
+    USI_BIT(); USI_BIT(); USI_BIT(); USI_BIT();
+
+    return USIDR;
+}
+
+
+//------------------------------------------------------------------------------
+void spi_bytes(uint8_t* pTx, uint8_t* pRx, uint8_t count)
+{
+    // Resolve the NULL buffers once, so the loop body has no tests.
+    // A NULL tx sends repeated zeros, a NULL rx discards into a scratch byte.
+    static uint8_t zero = 0;
+    uint8_t scratch;
+    uint8_t txstep = (pTx != NULL);
+    uint8_t rxstep = (pRx != NULL);
+    if (pTx == NULL) {pTx = &zero;}
+    if (pRx == NULL) {pRx = &scratch;}
+
+    while (count-- != 0)
+    {
+        *pRx = spi_byte(*pTx);
+        pTx += txstep;
+        pRx += rxstep;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+void spi_frame(uint8_t* pTx, uint8_t* pRx, uint8_t count)
+{
+    SELECT();
+    spi_bytes(pTx, pRx, count);
+    DESELECT();
+}
+
+
+/***** END OF FILE *****/
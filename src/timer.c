@@ -2,8 +2,15 @@
 //
 // Timer and delay services
 
+#include <avr/interrupt.h>
+#include <util/atomic.h>
 #include "timer.h"
 
+// Timer0 CTC at F_CPU/1024, TOP+1 counts per tick
+#define CLOCK_TOP ((F_CPU/1024UL) * TIMER_TICK_MS / 1000UL - 1)
+
+static volatile uint16_t clock_ticks = 0;
+
 //-----------------------------------------------------------------------------
 void timer_start(void)
 {
@@ -70,4 +77,33 @@ void timer_delay_ms(uint8_t amount) // up to 255ish ms
   }
 }
 
+//-----------------------------------------------------------------------------
+ISR(TIMER0_COMPA_vect)
+{
+  clock_ticks++;
+}
+
+
+//-----------------------------------------------------------------------------
+void timer_clock_start(void)
+{
+  TCCR0A = (1<<WGM01);           // CTC, TOP = OCR0A
+  OCR0A  = CLOCK_TOP;
+  TCCR0B = (1<<CS02)|(1<<CS00);  // 8MHz/1024
+  TIMSK |= (1<<OCIE0A);
+}
+
+
+//-----------------------------------------------------------------------------
+uint16_t timer_ticks(void)
+{
+  uint16_t t;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    t = clock_ticks;
+  }
+  return t;
+}
+
 // END OF FILE
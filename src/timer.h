@@ -17,5 +17,13 @@ void timer_wait_until(uint8_t target);
 void timer_delay_us(uint8_t amount);
 void timer_delay_ms(uint8_t amount);
 
+// Coarse clock, for things that need to know the time over seconds.
+// Timer0 interrupts every TIMER_TICK_MS (9.984ms at 8MHz), and the 16 bit
+// tick count wraps every 655s, so compare times as differences.
+// Only runs once timer_clock_start() is called.
+#define TIMER_TICK_MS 10
+void timer_clock_start(void);
+uint16_t timer_ticks(void);
+
 #endif
 